@@ -0,0 +1,13 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_ARITH_H
+#define MYSHELL_MSH_ARITH_H
+
+#include <cstdint>
+#include <string_view>
+
+int64_t evaluate_arithmetic(std::string_view expression);
+
+#endif //MYSHELL_MSH_ARITH_H
@@ -6,6 +6,7 @@
 #define TEMPLATE_MSH_BUILTIN_H
 
 #include "internal/msh_error.h"
+#include "types/msh_alias.h"
 #include "types/msh_builtin_doc.h"
 #include "types/msh_builin_command.h"
 
@@ -16,9 +17,9 @@
 
 using func_t = int (*)(int, char **);
 
-extern const std::map<std::string, builtin> builtin_commands;
+extern const std::map<std::string, builtin, std::less<>> builtin_commands;
 
-extern std::map<std::string, std::string> aliases;
+extern alias_table_t aliases;
 
 bool handle_help(int argc, char **argv, const builtin_doc &doc);
 
@@ -44,4 +45,12 @@ int munalias(int argc, char **argv);
 
 int mjobs(int argc, char **argv);
 
+int mhash(int argc, char **argv);
+
+int mreturn(int argc, char **argv);
+
+int mtest(int argc, char **argv);
+
+int mread(int argc, char **argv);
+
 #endif //TEMPLATE_MSH_BUILTIN_H
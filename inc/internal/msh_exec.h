@@ -7,25 +7,55 @@
 
 #include "types/msh_command_fwd.h"
 
+#include <string>
+#include <string_view>
+#include <vector>
 #include <unistd.h>
 
 
 extern int exec_line_no;
 extern std::string exec_path;
+extern pid_t last_pid;
+extern pid_t exec_pgid;
+extern std::string *exec_capture;
+extern int exec_captured_in;
+extern bool exec_returning;
 
 constexpr int BUILTIN = 1 << 0;
 constexpr int FORK_NO_WAIT = 1 << 1;
 constexpr int ASYNC = 1 << 2;
 constexpr int FORCE_PIPE = 1 << 3;
 constexpr int PIPE_STDERR = 1 << 4;
+constexpr int FUNCTION = 1 << 5;
+
+/**
+ * @brief Maximum nesting level of function calls.
+ *
+ * Can be overridden by setting MSH_MAX_CALL_DEPTH in CMakeLists.txt.
+ */
+#ifndef MSH_MAX_CALL_DEPTH
+#define MSH_MAX_CALL_DEPTH 1000
+#endif
 
 
 int msh_exec_script(const char *path);
 
-int msh_execve(char **argv);
+int msh_exec_stdin();
+
+int msh_exec_string(std::string_view commands);
+
+int msh_execve(char **argv, const char *path);
+
+void msh_write_output(int fd, std::string_view output);
+
+void msh_close_shell_fds();
 
 int msh_exec_simple(simple_command &cmd, int pipe_in, int pipe_out, int flags);
 
+int msh_exec_compound(compound_command &cmd, int in, int out, int flags);
+
+int msh_call_function(std::vector<std::string> args);
+
 int msh_exec_internal(command &cmd, int in = STDIN_FILENO, int out = STDOUT_FILENO, int flags = 0);
 
 #endif //TEMPLATE_MSH_EXEC_H
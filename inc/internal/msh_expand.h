@@ -0,0 +1,24 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_EXPAND_H
+#define MYSHELL_MSH_EXPAND_H
+
+#include "internal/msh_scan.h"
+#include "types/msh_token.h"
+
+#include <string>
+#include <string_view>
+
+const byte_set &get_ifs();
+
+void ifs_changed();
+
+std::string expand_vars(std::string_view value);
+
+size_t find_parameter_end(std::string_view value, size_t pos);
+
+tokens_t expand_tokens(const tokens_t &tokens);
+
+#endif //MYSHELL_MSH_EXPAND_H
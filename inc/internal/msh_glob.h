@@ -0,0 +1,34 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_GLOB_H
+#define MYSHELL_MSH_GLOB_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Maximum number of directory listings kept in the glob cache.
+ *
+ * Can be overridden by setting MSH_GLOB_CACHE_SIZE in CMakeLists.txt.
+ */
+#ifndef MSH_GLOB_CACHE_SIZE
+#define MSH_GLOB_CACHE_SIZE 65536
+#endif
+
+/**
+ * @brief Maximum number of threads reading directories during a recursive `**` walk.
+ *
+ * Can be overridden by setting MSH_GLOB_THREADS in CMakeLists.txt.
+ */
+#ifndef MSH_GLOB_THREADS
+#define MSH_GLOB_THREADS 8
+#endif
+
+std::vector<std::string> msh_glob(std::string_view pattern);
+
+void glob_cache_new_command();
+
+#endif //MYSHELL_MSH_GLOB_H
@@ -0,0 +1,41 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_HASH_H
+#define MYSHELL_MSH_HASH_H
+
+#include "types/msh_variable.h"
+
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Location of a command found in PATH.
+ *
+ * An empty @c path records that the command was not found.
+ */
+struct hashed_command {
+    std::string path;
+    size_t hits = 0;
+};
+
+/**
+ * @brief Lookup statistics of the command hash table.
+ */
+struct hash_stats {
+    size_t hits = 0;   ///< Lookups answered from the table
+    size_t misses = 0; ///< Lookups that searched PATH
+};
+
+extern std::unordered_map<std::string, hashed_command, variable_hash, std::equal_to<>> command_hash;
+
+extern hash_stats command_hash_stats;
+
+const std::string *hash_lookup(std::string_view name);
+
+const std::string *hash_add(std::string_view name);
+
+void hash_clear();
+
+#endif //MYSHELL_MSH_HASH_H
@@ -5,20 +5,27 @@
 #ifndef MYSHELL_MSH_INTERNAL_H
 #define MYSHELL_MSH_INTERNAL_H
 
+#include "types/msh_function.h"
 #include "types/msh_variable.h"
 
-#include <vector>
-
 constexpr auto SHELL = "msh";
 constexpr auto VERSION = "2.0.0";
 
-extern std::vector<variable> variables;
+extern variable_table_t variables;
+
+extern function_table_t functions;
+
+extern call_frame *current_frame;
 
 variable *get_variable(std::string_view name);
 
-void set_variable(const std::string &name, const std::string &value);
+variable &set_variable(std::string_view name, std::string value);
+
+void export_variable(variable &var);
+
+char **msh_environ();
 
-void msh_init();
+void msh_init(bool interactive);
 
 void msh_exit();
 
@@ -17,6 +17,7 @@
 
 #include <map>
 #include <sstream>
+#include <csignal>
 
 struct process;
 extern std::map<pid_t, process> processes;
@@ -43,5 +44,34 @@ void remove_process(pid_t pid);
 
 void set_process_status(pid_t pid, status_t status);
 
+void unblock_sigchld();
+
+/**
+ * @brief Blocks SIGCHLD for the lifetime of the object.
+ *
+ * While SIGCHLD is blocked, the SIGCHLD handler can't reap the processes the shell is
+ * about to wait for, nor modify the internal process table.
+ *
+ * @see sigchld_handler()
+ */
+struct sigchld_guard {
+    sigset_t old_mask{};
+
+    sigchld_guard() {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, &old_mask);
+    }
+
+    ~sigchld_guard() {
+        sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+    }
+
+    sigchld_guard(const sigchld_guard &) = delete;
+
+    sigchld_guard &operator=(const sigchld_guard &) = delete;
+};
+
 
 #endif //MYSHELL_MSH_JOBS_H
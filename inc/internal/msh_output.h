@@ -0,0 +1,78 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_OUTPUT_H
+#define MYSHELL_MSH_OUTPUT_H
+
+#include <charconv>
+#include <concepts>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Size of the buffer of the standard output of the shell.
+ *
+ * Can be overridden by setting MSH_OUTPUT_BUFFER_SIZE in CMakeLists.txt.
+ */
+#ifndef MSH_OUTPUT_BUFFER_SIZE
+#define MSH_OUTPUT_BUFFER_SIZE (64 << 10)
+#endif
+
+/**
+ * @brief Buffered output to a file descriptor.
+ *
+ * The output is collected across commands and written with a single writev() once the buffer
+ * is full or flush() is called. The file descriptor is looked up only when writing, so the
+ * buffer must be flushed before the descriptor is redirected, before a process that may write
+ * to it is started, before reading input and before exiting.
+ *
+ * While a capture string is set, the output is appended to it instead.
+ *
+ * @see msh_out
+ */
+class output_sink {
+public:
+    explicit output_sink(int fd);
+
+    output_sink(const output_sink &) = delete;
+
+    output_sink &operator=(const output_sink &) = delete;
+
+    void write(std::string_view data);
+
+    void flush();
+
+    std::string *capture(std::string *target);
+
+    output_sink &operator<<(std::string_view data) {
+        write(data);
+        return *this;
+    }
+
+    output_sink &operator<<(char c) {
+        write({&c, 1});
+        return *this;
+    }
+
+    template<std::integral T>
+    output_sink &operator<<(T value) {
+        char digits[24];
+        auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+        write({digits, static_cast<size_t>(end - digits)});
+        return *this;
+    }
+
+private:
+    int fd;
+    std::unique_ptr<char[]> buffer;
+    size_t size = 0;
+    std::string *captured = nullptr;
+};
+
+extern output_sink msh_out;
+
+void output_init();
+
+#endif //MYSHELL_MSH_OUTPUT_H
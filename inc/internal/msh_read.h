@@ -0,0 +1,25 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_READ_H
+#define MYSHELL_MSH_READ_H
+
+#include <string>
+
+/**
+ * @brief Size of the read-ahead buffer kept for a regular file read by `mread`.
+ *
+ * Can be overridden by setting MSH_READ_BUFFER_SIZE in CMakeLists.txt.
+ */
+#ifndef MSH_READ_BUFFER_SIZE
+#define MSH_READ_BUFFER_SIZE (64 << 10)
+#endif
+
+bool read_record(int fd, char delimiter, std::string &record);
+
+void read_buffer_release(int fd);
+
+void read_buffers_release();
+
+#endif //MYSHELL_MSH_READ_H
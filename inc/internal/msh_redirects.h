@@ -8,6 +8,75 @@
 #include "types/msh_redirect.h"
 #include "types/msh_token.h"
 
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Maximum size of a here-document passed through a pipe, larger ones are passed in a sealed memfd.
+ *
+ * Must not exceed the capacity of a pipe, 64K on Linux by default.
+ * Can be overridden by setting MSH_HEREDOC_PIPE_SIZE in CMakeLists.txt.
+ */
+#ifndef MSH_HEREDOC_PIPE_SIZE
+#define MSH_HEREDOC_PIPE_SIZE 65536
+#endif
+
 redirects_t parse_redirects(tokens_t &tokens);
 
+/**
+ * @brief Redirections compiled into a flat sequence of dup2() calls.
+ *
+ * All redirection targets are opened by compile() in the parent, with O_CLOEXEC and above
+ * every file descriptor being redirected, so the sequence can't overwrite a file before it is
+ * used. Applying the plan only issues dup2() calls, without allocating or formatting messages,
+ * so it's safe in a child of fork() or vfork() and can be handed over to posix_spawn().
+ *
+ * In the shell process, perform() saves just the file descriptors the plan redirects, and
+ * undo() restores them.
+ *
+ * @see parse_redirects
+ */
+class redirect_plan {
+public:
+    /**
+     * @brief A single `dup2(from, to)` call.
+     */
+    struct step {
+        int from;
+        int to;
+    };
+
+    redirect_plan() = default;
+
+    ~redirect_plan();
+
+    redirect_plan(const redirect_plan &) = delete;
+
+    redirect_plan &operator=(const redirect_plan &) = delete;
+
+    int compile(const redirects_t &redirects);
+
+    [[nodiscard]] const std::vector<step> &get_steps() const {
+        return steps;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return steps.empty();
+    }
+
+    int apply() const;
+
+    int perform();
+
+    void undo();
+
+private:
+    std::vector<step> steps;
+    std::vector<int> opened; ///< Targets opened by compile(), closed once the plan is applied
+    std::vector<std::pair<int, int>> saved; ///< Redirected file descriptors and their copies, -1 if closed
+    int max_target = 2; ///< The highest file descriptor being redirected
+
+    void close_opened();
+};
+
 #endif //MYSHELL_MSH_REDIRECTS_H
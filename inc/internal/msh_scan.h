@@ -0,0 +1,40 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_SCAN_H
+#define MYSHELL_MSH_SCAN_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief A set of bytes prepared for vectorized searching.
+ *
+ * Holds the same set in three representations: a lookup table for the scalar scanner,
+ * the list of bytes for the SSE2 scanner and the nibble tables for the AVX2 scanner.
+ *
+ * @see find_first_of()
+ * @see find_first_not_of()
+ */
+struct byte_set {
+    std::array<bool, 256> table{};
+    std::string bytes;
+    alignas(32) std::array<uint8_t, 32> lo_nibbles{};
+    alignas(32) std::array<uint8_t, 32> hi_nibbles{};
+    bool nibble_lookup = true;
+
+    explicit byte_set(std::string_view set);
+
+    [[nodiscard]] bool contains(char c) const {
+        return table[static_cast<unsigned char>(c)];
+    }
+};
+
+size_t find_first_of(std::string_view input, size_t pos, const byte_set &set);
+
+size_t find_first_not_of(std::string_view input, size_t pos, const byte_set &set);
+
+#endif //MYSHELL_MSH_SCAN_H
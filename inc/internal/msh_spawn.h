@@ -0,0 +1,16 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_SPAWN_H
+#define MYSHELL_MSH_SPAWN_H
+
+#include "internal/msh_redirects.h"
+#include "types/msh_command_fwd.h"
+
+#include <unistd.h>
+
+pid_t msh_spawn(simple_command &cmd, const redirect_plan &redirects, const char *path, int pipe_in, int pipe_out,
+                int flags);
+
+#endif //MYSHELL_MSH_SPAWN_H
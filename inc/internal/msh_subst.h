@@ -0,0 +1,126 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_SUBST_H
+#define MYSHELL_MSH_SUBST_H
+
+#include "internal/msh_jobs.h"
+#include "types/msh_command_fwd.h"
+#include "types/msh_token.h"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Size of the captured output of a command substitution, after which it is moved
+ * from the heap to a memfd.
+ *
+ * Can be overridden by setting MSH_SUBST_SPILL_THRESHOLD in CMakeLists.txt.
+ */
+#ifndef MSH_SUBST_SPILL_THRESHOLD
+#define MSH_SUBST_SPILL_THRESHOLD (4 << 20)
+#endif
+
+/**
+ * @brief Maximum number of command substitutions of one command running at the same time.
+ *
+ * Can be overridden by setting MSH_SUBST_MAX_JOBS in CMakeLists.txt.
+ */
+#ifndef MSH_SUBST_MAX_JOBS
+#define MSH_SUBST_MAX_JOBS 8
+#endif
+
+/**
+ * @brief Size of a regular file read by `$(<file)`, from which it is mapped into memory
+ * instead of being read.
+ *
+ * Can be overridden by setting MSH_SUBST_MMAP_THRESHOLD in CMakeLists.txt.
+ */
+#ifndef MSH_SUBST_MMAP_THRESHOLD
+#define MSH_SUBST_MMAP_THRESHOLD (256 << 10)
+#endif
+
+/**
+ * @brief Output of a command substitution.
+ *
+ * @c value is a view into @c arena, so it can be turned into tokens without copying.
+ */
+struct captured_output {
+    arena_t arena;
+    std::string_view value;
+};
+
+/**
+ * @brief Command substitutions of a simple command, evaluated concurrently.
+ *
+ * The substitutions of one command don't depend on each other, so they are all started
+ * up front, at most MSH_SUBST_MAX_JOBS at a time, and their outputs are collected in order
+ * with next(). Substitutions executed in-process, as well as `$(<file)`, are evaluated
+ * by next() itself.
+ *
+ * Subshells that were not collected are waited for on destruction.
+ */
+class substitution_queue {
+public:
+    explicit substitution_queue(const tokens_t &tokens);
+
+    ~substitution_queue();
+
+    substitution_queue(const substitution_queue &) = delete;
+
+    substitution_queue &operator=(const substitution_queue &) = delete;
+
+    captured_output next();
+
+private:
+    struct substitution {
+        std::shared_ptr<command> cmd; ///< Null if the command failed to parse
+        bool in_process = false;
+        bool reads_file = false; ///< `$(<file)`, the file is read without a subshell
+        pid_t pid = 0;
+        int fd = -1;
+    };
+
+    std::vector<substitution> substitutions;
+    size_t current = 0; ///< Next substitution to collect
+    size_t launched = 0; ///< Next substitution to start
+    size_t running = 0;
+    std::optional<sigchld_guard> guard;
+
+    void launch();
+};
+
+std::string start_process_substitution(std::string_view cmd, bool output);
+
+/**
+ * @brief Process substitutions started during the lifetime of the object, e.g. while a
+ * command is expanded.
+ *
+ * The file descriptors of the substitutions are left open for the consuming command and
+ * must be closed once it is launched, by close() or on destruction. The subshells are
+ * reaped on destruction if @c wait is set. Otherwise they are left to the enclosing scope,
+ * e.g. the pipeline the command is a stage of, or to the SIGCHLD handler if there is none.
+ *
+ * @see start_process_substitution
+ */
+class process_substitution_scope {
+public:
+    explicit process_substitution_scope(bool wait);
+
+    ~process_substitution_scope();
+
+    process_substitution_scope(const process_substitution_scope &) = delete;
+
+    process_substitution_scope &operator=(const process_substitution_scope &) = delete;
+
+    void close();
+
+private:
+    size_t first; ///< The first substitution started in this scope
+    bool wait;
+};
+
+#endif //MYSHELL_MSH_SUBST_H
@@ -16,20 +16,8 @@
 
 std::string generate_prompt();
 
-tokens_t split_words(const std::string_view input);
-
-void set_variables(tokens_t &tokens);
-
 void expand_aliases(tokens_t &tokens);
 
-void expand_glob(tokens_t &tokens);
-
-void expand_vars(tokens_t &tokens);
-
-void squash_tokens(tokens_t &tokens);
-
-void process_tokens(tokens_t &tokens);
-
 void check_syntax(const tokens_t &tokens);
 
 simple_command_ptr make_simple_command(const tokens_t &tokens);
@@ -0,0 +1,28 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_ALIAS_H
+#define MYSHELL_MSH_ALIAS_H
+
+#include "msh_token.h"
+
+#include <map>
+#include <string>
+
+/**
+ * @brief Internal alias structure.
+ *
+ * The value is lexed once when the alias is defined, @c tokens are spliced into
+ * the command line on every expansion.
+ *
+ * @see expand_aliases
+ */
+struct alias {
+    std::string value;
+    tokens_t tokens;
+};
+
+using alias_table_t = std::map<std::string, alias, std::less<>>;
+
+#endif //MYSHELL_MSH_ALIAS_H
@@ -8,6 +8,8 @@
 #include <string>
 
 constexpr int DECLARATION_COMMAND = 1 << 0;
+constexpr int NO_SIDE_EFFECTS = 1 << 1; ///< Only writes to the standard output, may be executed in-process anywhere
+constexpr int CONDITIONAL_COMMAND = 1 << 2; ///< Arguments are neither split nor globbed, quoted pattern characters are escaped
 
 using builtin_func_t = int (*)(int, char **);
 
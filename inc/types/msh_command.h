@@ -14,6 +14,9 @@
 #include "internal/msh_jobs.h"
 #include "internal/msh_utils.h"
 #include "internal/msh_redirects.h"
+#include "internal/msh_subst.h"
+#include "internal/msh_expand.h"
+#include "internal/msh_internal.h"
 
 #include "msh_redirect.h"
 #include "msh_token.h"
@@ -30,23 +33,27 @@
 #include <array>
 #include <memory>
 #include <variant>
+#include <fcntl.h>
 #include <sys/wait.h>
 
 
 /**
  * @brief Top-level command structure.
  *
- * Holds @c std::variant of @c simple_command_ptr and @c connection_command_ptr.
+ * Holds @c std::variant of @c simple_command_ptr, @c connection_command_ptr,
+ * @c pipeline_command_ptr and @c compound_command_ptr.
  *
  * On @c execute() the execution is delegated to the appropriate command using
  * @c msh_exec_internal().
  *
  * @see simple_command_t
  * @see connection_command_t
+ * @see pipeline_command_t
+ * @see compound_command_t
  * @see msh_exec_internal()
  */
 struct command {
-    std::variant<simple_command_ptr, connection_command_ptr> cmd;
+    std::variant<simple_command_ptr, connection_command_ptr, pipeline_command_ptr, compound_command_ptr> cmd;
     int flags = 0;
 
     /**
@@ -79,8 +86,9 @@ struct command {
  * The minimal unit of execution. Requires a @c std::vector of @c tokens_t
  * to be constructed.
  *
- * On @c execute() the tokens are processed and the command is executed using
- * @c msh_exec_simple().
+ * On @c execute() the tokens are expanded and the command is executed using
+ * @c msh_exec_simple(). The tokens themselves are left intact, so the same command
+ * can be executed any number of times.
  *
  * @see msh_exec_simple()
  */
@@ -92,7 +100,6 @@ typedef struct simple_command {
     tokens_t tokens;
     args_t argv;
     argv_c_t argv_c;
-    std::array<int, 3> saved_fds{};
     redirects_t redirects;
     int argc = 0;
 
@@ -103,12 +110,16 @@ typedef struct simple_command {
      *
      * Constructs the command arguments array @c argv_c and the number of arguments @c argc.
      *
-     * @note Should only be called after tokens processing.
+     * @param words The expanded tokens of the command.
+     *
+     * @see expand_tokens()
      */
-    bool construct() {
-        for (auto const &token: tokens) {
-            if (token.get_flag(WORD_LIKE) && !token.value.empty()) {
-                argv.push_back(token.value);
+    bool construct(const tokens_t &words) {
+        argv.clear();
+        argv_c.clear();
+        for (auto const &token: words) {
+            if (token.get_flag(WORD_LIKE)) {
+                argv.emplace_back(token.value());
             }
         }
         for (auto &arg: argv) {
@@ -118,56 +129,6 @@ typedef struct simple_command {
         return (argc = static_cast<int>(argv.size())) != 0;
     }
 
-    /**
-     * @brief Perform redirections attached to the command.
-     *
-     * @param fd_to_close Vector of file descriptors to close after the command is executed.
-     * @return 0 on success, error code otherwise.
-     *
-     * @note All standard file descriptors are saved before performing the redirections.
-     * @note File descriptors opened by redirections are added to @c fd_to_close.
-     * They should be closed after the command is executed or earlier if the command fails.
-     *
-     * @see msh_redirects.h
-     */
-    int do_redirects(std::vector<int> *fd_to_close) {
-        if (redirects.empty()) {
-            return 0;
-        }
-
-        saved_fds[0] = dup(STDIN_FILENO);
-        saved_fds[1] = dup(STDOUT_FILENO);
-        saved_fds[2] = dup(STDERR_FILENO);
-        for (auto const &redirect: redirects) {
-            if (auto res = redirect.do_redirect(fd_to_close); res != 0) {
-                return res;
-            }
-        }
-        return 0;
-    }
-
-    /**
-     * @brief Undo redirections attached to the command.
-     *
-     * @param fd_to_close Vector of file descriptors to close.
-     *
-     * @note Should be called after the command is executed or earlier if the command fails.
-     *
-     * Restores standard file descriptors and closes all file descriptors specified
-     * by @c fd_to_close.
-     */
-    void undo_redirects(std::vector<int> const &fd_to_close) {
-        if (redirects.empty()) {
-            return;
-        }
-
-        dup2(saved_fds[0], STDIN_FILENO);
-        dup2(saved_fds[1], STDOUT_FILENO);
-        dup2(saved_fds[2], STDERR_FILENO);
-        std::ranges::for_each(saved_fds, close);
-        std::ranges::for_each(fd_to_close, close);
-    }
-
     /**
      * @brief Execute the command.
      *
@@ -179,19 +140,26 @@ typedef struct simple_command {
      * @see msh_exec_simple()
      */
     int execute(int in = STDIN_FILENO, int out = STDOUT_FILENO, int flags = 0) {
+        // Reaped once the command completes, or with the pipeline it is a stage of
+        process_substitution_scope substitutions(!(flags & (ASYNC | FORK_NO_WAIT)));
+        tokens_t words;
         try {
-            process_tokens(tokens);
-            redirects = parse_redirects(tokens);
+            words = expand_tokens(tokens);
+            redirects = parse_redirects(words);
         } catch (msh_exception &e) {
             msh_error(e.what());
             return e.code();
         }
 
-        if (!construct()) {
+        if (!construct(words)) {
             return 0;
         }
 
-        is_builtin(argv[0]) ? flags |= BUILTIN : flags |= 0;
+        if (functions.contains(argv[0])) {
+            flags |= FUNCTION;
+        } else if (is_builtin(argv[0])) {
+            flags |= BUILTIN;
+        }
         msh_errno = msh_exec_simple(*this, in, out, flags);
 
         return msh_errno;
@@ -203,10 +171,12 @@ typedef struct simple_command {
  * @brief Connection command structure.
  *
  * Represents a connection between two commands. Holds a @c Token specifying the
- * type of connection and two @c command structures.
+ * type of connection and two @c command structures. Pipelines are represented by
+ * @c pipeline_command instead.
  *
  * On @c execute() the execution is delegated to the appropriate function
- * depending on the type of connection.
+ * depending on the type of connection. The right-hand side command is skipped
+ * if the left-hand side one executed `mreturn`.
  *
  * @see command
  * @see Token
@@ -230,11 +200,6 @@ typedef struct connection_command {
     int execute(int in = STDIN_FILENO, int out = STDOUT_FILENO, int flags = 0) {
         switch (connector.type) {
             using enum TokenType;
-            case TokenType::PIPE_AMP:
-                flags |= PIPE_STDERR;
-                [[fallthrough]];
-            case PIPE:
-                return execute_pipeline(in, out, flags);
             case SEMICOLON:
                 return execute_sequence(in, out, flags);
             case AMP:
@@ -267,6 +232,9 @@ private:
         rhs.set_flags(flags & ASYNC);
 
         auto res = flags & FORCE_PIPE ? lhs.execute(in, out) : lhs.execute();
+        if (exec_returning) {
+            return res;
+        }
         if ((res == 0 && op == TokenType::AND) || (res != 0 && op == TokenType::OR)) {
             rhs.execute(in, out);
         }
@@ -291,7 +259,9 @@ private:
         rhs.set_flags(flags & ASYNC);
 
         flags & FORCE_PIPE ? lhs.execute(in, out) : lhs.execute();
-        rhs.execute(in, out);
+        if (!exec_returning) {
+            rhs.execute(in, out);
+        }
         return msh_errno;
     }
 
@@ -311,44 +281,308 @@ private:
         rhs.set_flags(flags & ASYNC);
 
         flags & FORCE_PIPE ? lhs.execute(in, out) : lhs.execute();
-        rhs.execute(in, out);
+        if (!exec_returning) {
+            rhs.execute(in, out);
+        }
         return msh_errno;
     }
 
+} connection_command_t;
+
+
+/**
+ * @brief Pipeline command structure.
+ *
+ * Represents a whole pipeline of any number of commands connected with `|` or `|&`.
+ *
+ * On @c execute() all the stages are launched at once in a single process group, each
+ * connected to the next one with a pipe. A foreground pipeline then waits for its own
+ * processes only, leaving any background jobs alone.
+ *
+ * Builtins without side effects, e.g. `mecho`, are executed in-process. Their output is
+ * captured and written to their pipes once all the stages are launched, so a full pipe
+ * can't block the shell before the reader is running.
+ *
+ * The subshells of process substitutions in the stages are reaped along with the stages.
+ *
+ * The exit status of the pipeline is the exit status of its last stage. Exit statuses of
+ * all stages are stored in the PIPESTATUS variable as a space separated list.
+ *
+ * @see command
+ */
+typedef struct pipeline_command {
+    std::vector<command> stages;
+    std::vector<int> stage_flags;
+
     /**
-     * @brief Executes pipeline connections, i.e. `|` and `|&`.
+     * @brief Append a stage to the pipeline.
      *
-     * Executes the left-hand side command and then the right-hand side command
-     * sequentially with the output of the left-hand side command piped to the
-     * input of the right-hand side command. If the connection is `|&`, the
-     * standard error of the left-hand side command is also piped.
+     * @param stage The command to append.
+     * @param connector The connector following the stage, i.e. `|` or `|&`.
+     * Should be @c nullptr for the last stage.
+     */
+    void add_stage(command stage, const Token *connector) {
+        stages.push_back(std::move(stage));
+        stage_flags.push_back(connector != nullptr && connector->type == TokenType::PIPE_AMP ? PIPE_STDERR : 0);
+    }
+
+    /**
+     * @brief Execute the command.
+     *
+     * @param in File descriptor to use as stdin of the first stage.
+     * @param out File descriptor to use as stdout of the last stage.
+     * @param flags Flags to pass to the stages.
+     * @return Exit code of the last stage.
+     */
+    int execute(int in = STDIN_FILENO, int out = STDOUT_FILENO, int flags = 0) {
+        // Keep the SIGCHLD handler from reaping the stages until all of them are waited for
+        sigchld_guard guard;
+        process_substitution_scope substitutions(!(flags & ASYNC));
+
+        std::vector<pid_t> pids(stages.size(), -1);
+        std::vector<int> statuses(stages.size(), 0);
+
+        std::vector<std::string> outputs(stages.size());
+        std::vector<int> output_fds(stages.size(), -1);
+
+        auto saved_pgid = exec_pgid;
+        auto saved_capture = exec_capture;
+        exec_pgid = 0;
+
+        int stage_in = in;
+        for (size_t i = 0; i < stages.size(); ++i) {
+            int pipefd[2] = {-1, out};
+            if (i + 1 < stages.size() && pipe2(pipefd, O_CLOEXEC) == -1) {
+                msh_error(strerror(errno));
+                std::fill(statuses.begin() + static_cast<long>(i), statuses.end(), UNKNOWN_ERROR);
+                if (stage_in != in) {
+                    close(stage_in);
+                }
+                break;
+            }
+
+            last_pid = -1;
+            exec_capture = &outputs[i];
+            stages[i].set_flags(flags | FORK_NO_WAIT | stage_flags[i]);
+            statuses[i] = stages[i].execute(stage_in, pipefd[1]);
+            if (last_pid != -1) {
+                pids[i] = last_pid;
+                if (exec_pgid == 0) {
+                    exec_pgid = last_pid;
+                }
+            }
+
+            if (stage_in != in) {
+                close(stage_in);
+            }
+            if (!outputs[i].empty()) {
+                output_fds[i] = pipefd[1];
+            } else if (pipefd[1] != out) {
+                close(pipefd[1]);
+            }
+            stage_in = pipefd[0];
+        }
+
+        auto pgid = exec_pgid;
+        exec_pgid = saved_pgid;
+        exec_capture = saved_capture;
+
+        for (size_t i = 0; i < output_fds.size(); ++i) {
+            if (output_fds[i] == -1) {
+                continue;
+            }
+            msh_write_output(output_fds[i], outputs[i]);
+            if (output_fds[i] != out) {
+                close(output_fds[i]);
+            }
+        }
+
+        if (flags & ASYNC) {
+            return statuses.back();
+        }
+
+        bool foreground = pgid > 0 && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+        if (foreground) {
+            tcsetpgrp(STDIN_FILENO, pgid);
+            // Stages that tried to read from the terminal before they got it are stopped
+            kill(-pgid, SIGCONT);
+        }
+
+        for (size_t i = 0; i < pids.size(); ++i) {
+            if (pids[i] != -1) {
+                wait_for_process(pids[i], &statuses[i]);
+            }
+        }
+
+        if (foreground) {
+            // The shell is now in the background, SIGTTOU has to be blocked to take the terminal back
+            sigset_t mask, old_mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGTTOU);
+            sigprocmask(SIG_BLOCK, &mask, &old_mask);
+            tcsetpgrp(STDIN_FILENO, getpgrp());
+            sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+        }
+
+        std::string pipestatus;
+        for (auto status: statuses) {
+            if (!pipestatus.empty()) {
+                pipestatus += ' ';
+            }
+            pipestatus += std::to_string(status);
+        }
+        set_variable("PIPESTATUS", std::move(pipestatus));
+        return statuses.back();
+    }
+} pipeline_command_t;
+
+
+/**
+ * @brief Compound command structure, i.e. `if`, `while`, `until`, `for`, `{ }` and function definitions.
+ *
+ * The parts of the command are parsed once into commands of their own, so executing the
+ * body of a loop or a function only expands its tokens again.
+ *
+ * <li> `if`: @c conditions holds the conditions of `if` and every `elif`, @c bodies the
+ * corresponding bodies followed by the body of `else`, if any. </li>
+ * <li> `while` and `until`: @c conditions holds the condition, @c bodies the body. </li>
+ * <li> `for`: @c variable is set to each of the expanded @c words in turn, @c bodies holds the body. </li>
+ * <li> `{ }`: @c bodies holds the list of commands. </li>
+ * <li> `name() body`: defines the function @c variable, @c bodies holds the body, a compound command. </li>
+ *
+ * Redirections following the command apply to the whole command. If the command is a stage
+ * of a pipeline or executed asynchronously, it is executed in a subshell.
+ *
+ * Executing `mreturn` stops the command, see @c exec_returning.
+ *
+ * @see command
+ * @see msh_exec_compound()
+ */
+typedef struct compound_command {
+    enum kind_t {
+        IF,
+        WHILE,
+        UNTIL,
+        FOR,
+        GROUP,
+        FUNCTION,
+    } kind = IF;
+
+    std::vector<command> conditions;
+    std::vector<command> bodies;
+    std::string variable;
+    tokens_t words;
+    tokens_t redirections;
+
+    /**
+     * @brief Execute the command.
      *
      * @param in File descriptor to use as stdin.
      * @param out File descriptor to use as stdout
-     * @param flags Flags to pass to the command.
+     * @param flags Flags to pass to msh_exec_compound().
+     * @return Exit code of the command.
+     *
+     * @see msh_exec_compound()
+     */
+    int execute(int in = STDIN_FILENO, int out = STDOUT_FILENO, int flags = 0) {
+        return msh_exec_compound(*this, in, out, flags);
+    }
+
+    /**
+     * @brief Perform the redirections and execute the command in the current process.
      *
      * @return Exit code of the command.
      */
-    int execute_pipeline(int in, int out, int flags) {
-        int pipefd[2];
-        if (pipe(pipefd) == -1) {
-            msh_error(strerror(errno));
-            return UNKNOWN_ERROR; // FIXME: Add error handling
+    int run() {
+        if (redirections.empty()) {
+            return run_body();
         }
 
-        lhs.set_flags(flags | FORK_NO_WAIT);
-        rhs.set_flags(flags);
+        redirects_t redirects;
+        process_substitution_scope substitutions(true);
+        try {
+            auto words = expand_tokens(redirections);
+            redirects = parse_redirects(words);
+        } catch (msh_exception &e) {
+            msh_error(e.what());
+            return e.code();
+        }
 
-        lhs.execute(in, pipefd[1]);
-        close(pipefd[1]);
-        rhs.execute(pipefd[0], out);
-        close(pipefd[0]);
+        // Not a member, a function may execute this command again before the redirections are undone
+        redirect_plan plan;
+        auto res = plan.compile(redirects);
+        // The plan holds its own copies
+        substitutions.close();
+        if (res != 0) {
+            return res;
+        }
+        if (auto res = plan.perform(); res != 0) {
+            plan.undo();
+            return res;
+        }
+        auto status = run_body();
+        plan.undo();
+        return status;
+    }
 
-        if (!(flags & FORK_NO_WAIT) && !(flags & ASYNC)) {
-            reap_children();
+private:
+    int run_body() {
+        int status = 0;
+        switch (kind) {
+            case IF:
+                for (size_t i = 0; i < conditions.size(); ++i) {
+                    status = conditions[i].execute();
+                    if (exec_returning) {
+                        return status;
+                    }
+                    if (status == 0) {
+                        return bodies[i].execute();
+                    }
+                }
+                return bodies.size() > conditions.size() ? bodies.back().execute() : 0;
+            case WHILE:
+            case UNTIL:
+                status = 0;
+                while (!exec_returning) {
+                    auto condition = conditions.front().execute();
+                    if (exec_returning) {
+                        return condition;
+                    }
+                    if ((condition == 0) != (kind == WHILE)) {
+                        break;
+                    }
+                    status = bodies.front().execute();
+                }
+                return status;
+            case FOR: {
+                // Open for the whole loop
+                process_substitution_scope substitutions(true);
+                tokens_t expanded;
+                try {
+                    expanded = expand_tokens(words);
+                } catch (msh_exception &e) {
+                    msh_error(e.what());
+                    return e.code();
+                }
+                for (auto const &word: expanded) {
+                    if (exec_returning) {
+                        break;
+                    }
+                    if (word.get_flag(WORD_LIKE)) {
+                        set_variable(variable, std::string{word.value()});
+                        status = bodies.front().execute();
+                    }
+                }
+                return status;
+            }
+            case GROUP:
+                return bodies.front().execute();
+            case FUNCTION:
+                functions[variable] = std::get<compound_command_ptr>(bodies.front().cmd);
+                return 0;
         }
-        return msh_errno;
+        return status;
     }
-} connection_command_t;
+} compound_command_t;
 
 #endif //TEMPLATE_MSH_COMMAND_H
@@ -10,7 +10,11 @@
 struct command;
 using simple_command_t = struct simple_command;
 using connection_command_t = struct connection_command;
+using pipeline_command_t = struct pipeline_command;
+using compound_command_t = struct compound_command;
 using simple_command_ptr = std::shared_ptr<simple_command_t>;
 using connection_command_ptr = std::shared_ptr<connection_command_t>;
+using pipeline_command_ptr = std::shared_ptr<pipeline_command_t>;
+using compound_command_ptr = std::shared_ptr<compound_command_t>;
 
 #endif //MYSHELL_MSH_COMMAND_FWD_H
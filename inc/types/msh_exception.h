@@ -33,4 +33,30 @@ private:
     msh_err err;
 };
 
+/**
+ * @brief Thrown if the input ends in the middle of a command, e.g. inside a loop or a quoted string.
+ *
+ * The input is valid so far, the caller may read more lines and parse the whole input again.
+ *
+ * @see parse_input
+ */
+class msh_incomplete_input : public msh_exception {
+public:
+    explicit msh_incomplete_input(std::string message, std::string delimiter = {}) :
+    msh_exception(std::move(message), INTERNAL_ERROR), delimiter(std::move(delimiter)) {}
+
+    /**
+     * @brief The delimiter of an unfinished here-document, empty otherwise.
+     *
+     * Parsing can't succeed before a line equal to the delimiter is read, so the caller may
+     * read up to it before parsing again.
+     */
+    [[nodiscard]] const std::string &get_delimiter() const noexcept {
+        return delimiter;
+    }
+
+private:
+    std::string delimiter;
+};
+
 #endif //MYSHELL_MSH_EXCEPTION_H
@@ -0,0 +1,34 @@
+//
+// Created by andrew on 10/17/26.
+//
+
+#ifndef MYSHELL_MSH_FUNCTION_H
+#define MYSHELL_MSH_FUNCTION_H
+
+#include "msh_command_fwd.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Positional parameters of a function call.
+ *
+ * Frames live on the stack of msh_call_function() and are linked to the frame of the
+ * caller. There are no positional parameters outside of functions.
+ *
+ * @see msh_call_function
+ */
+struct call_frame {
+    std::vector<std::string> args; ///< The name of the function followed by the positional parameters
+    call_frame *previous = nullptr;
+    int depth = 1;
+    int status = 0; ///< Exit status set by `mreturn`
+};
+
+/**
+ * @brief Functions are stored as the parsed bodies, executed without parsing them again.
+ */
+using function_table_t = std::map<std::string, compound_command_ptr, std::less<>>;
+
+#endif //MYSHELL_MSH_FUNCTION_H
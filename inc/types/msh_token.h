@@ -9,7 +9,12 @@
 #ifndef MYSHELL_MSH_TOKEN_H
 #define MYSHELL_MSH_TOKEN_H
 
+#include "msh_exception.h"
+
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <map>
 #include <vector>
@@ -40,6 +45,11 @@ enum class TokenType {
     SUBOPEN,
     SUBCLOSE,
     COM_SUB,
+    ARITH,
+    HEREDOC,
+    HERESTRING,
+    PROC_SUB_IN,
+    PROC_SUB_OUT,
 };
 
 extern const std::map<TokenType, int> token_flags;
@@ -61,19 +71,43 @@ constexpr int REDIRECT = 1 << 6; ///< This token is a redirect. Used for parsing
 constexpr int ASSIGNMENT_WORD = 1 << 7; ///< This token is an assignment word. Used for parsing
 /** @} */
 
+/**
+ * @brief Shared immutable character storage referenced by tokens.
+ *
+ * The lexer copies its input into a single arena once and every token it produces is a
+ * slice of it. Expansions that rewrite a word allocate a fresh arena for the new value only.
+ *
+ * @see Token
+ */
+using arena_t = std::shared_ptr<const char>;
+
+/**
+ * @brief Create an arena owning the given string.
+ *
+ * @param value The string to take ownership of.
+ * @return The arena pointing to the first character of @p value.
+ */
+inline arena_t make_arena(std::string value) {
+    auto owner = std::make_shared<const std::string>(std::move(value));
+    return {owner, owner->data()};
+}
+
 /**
  * @brief Structure representing a token.
  *
  * Token is a single unit of input produced by the lexer and used throughout the shell.
  * All processing operations are performed on tokens.
  *
+ * The token doesn't own its value. It is a view of @c length characters starting at
+ * @c offset in the shared @c arena, so copying a token never copies the underlying string.
+ *
  * @see tokens_t
  * @see TokenType
  * @see token_flags
+ * @see arena_t
  */
 struct Token {
     TokenType type = TokenType::EMPTY;
-    std::string value;
     int flags = 0;
 
     Token() = default;
@@ -82,8 +116,14 @@ struct Token {
         flags = token_flags.at(type);
     }
 
-    Token(TokenType t, std::string value) : type(t), value(std::move(value)) {
+    Token(TokenType t, std::string value) : type(t) {
         flags = token_flags.at(type);
+        set_value(std::move(value));
+    }
+
+    Token(TokenType t, arena_t arena, size_t offset, size_t length) : type(t) {
+        flags = token_flags.at(type);
+        set_view(std::move(arena), offset, length);
     }
 
     void set_type(TokenType t) {
@@ -102,6 +142,43 @@ struct Token {
     [[maybe_unused]] void unset_flag(int flag) {
         flags &= ~flag;
     }
+
+    [[nodiscard]] std::string_view value() const {
+        return arena ? std::string_view{arena.get() + offset, length} : std::string_view{};
+    }
+
+    [[nodiscard]] const arena_t &get_arena() const {
+        return arena;
+    }
+
+    /**
+     * @brief Replace the value of the token with an owned string.
+     *
+     * @param value The new value.
+     */
+    void set_value(std::string value) {
+        auto size = value.size();
+        set_view(make_arena(std::move(value)), 0, size);
+    }
+
+    /**
+     * @brief Make the token a view of @p length characters at @p offset in @p arena.
+     *
+     * @throws msh_exception if the view doesn't fit in the compact representation.
+     */
+    void set_view(arena_t new_arena, size_t new_offset, size_t new_length) {
+        if (new_offset > UINT32_MAX || new_length > UINT32_MAX - new_offset) {
+            throw msh_exception("token is too long", INTERNAL_ERROR);
+        }
+        arena = std::move(new_arena);
+        offset = static_cast<uint32_t>(new_offset);
+        length = static_cast<uint32_t>(new_length);
+    }
+
+private:
+    arena_t arena;
+    uint32_t offset = 0;
+    uint32_t length = 0;
 };
 
 #endif //MYSHELL_MSH_TOKEN_H
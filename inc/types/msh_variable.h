@@ -6,13 +6,33 @@
 #define MYSHELL_MSH_VARIABLE_H
 
 #include <string>
+#include <string_view>
+#include <functional>
+#include <unordered_map>
 
 /**
  * @brief Internal variable structure.
+ *
+ * @c name is a view of the key the variable is stored under in the variable table,
+ * so every name is stored exactly once.
  */
 struct variable {
-    std::string name;
+    std::string_view name;
     std::string value;
+    bool exported = false; ///< Whether the variable is passed to the environment of executed commands
 };
 
+/**
+ * @brief Transparent string hash, allows looking up the variable table by @c std::string_view.
+ */
+struct variable_hash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view name) const noexcept {
+        return std::hash<std::string_view>{}(name);
+    }
+};
+
+using variable_table_t = std::unordered_map<std::string, variable, variable_hash, std::equal_to<>>;
+
 #endif //MYSHELL_MSH_VARIABLE_H
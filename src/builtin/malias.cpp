@@ -11,6 +11,7 @@
  */
 
 #include "internal/msh_builtin.h"
+#include "internal/msh_parser.h"
 
 #include <boost/program_options.hpp>
 
@@ -21,7 +22,7 @@ static const builtin_doc doc = {
         .doc    = "Without arguments, prints all aliases.\n\n"
                   "If arguments are given, creates an alias for each argument of the form NAME=VALUE\n"
                   "or prints the value of the alias with the given name.\n\n"
-                  "Returns 0 unless an unknown alias is given."
+                  "Returns 0 unless an unknown alias or an invalid value is given."
 };
 
 int malias(int argc, char **argv) {
@@ -36,8 +37,8 @@ int malias(int argc, char **argv) {
     }
 
     if (argc == 1) {
-        for (auto const &[name, value]: aliases) {
-            std::cout << "alias " << name << "=" << "'" << value << "'" << std::endl;
+        for (auto const &[name, alias]: aliases) {
+            std::cout << "alias " << name << "=" << "'" << alias.value << "'" << '\n';
         }
         return 0;
     }
@@ -47,7 +48,7 @@ int malias(int argc, char **argv) {
         auto pos = arg.find('=');
         if (pos == std::string::npos) {
             if (aliases.contains(arg)) {
-                std::cout << "alias " << arg << "=" << "'" << aliases[arg] << "'" << std::endl;
+                std::cout << "alias " << arg << "=" << "'" << aliases[arg].value << "'" << '\n';
             } else {
                 msh_error(doc.name + ": " + arg + ": not found");
                 return 1;
@@ -55,7 +56,13 @@ int malias(int argc, char **argv) {
         } else {
             auto name = arg.substr(0, pos);
             auto value = arg.substr(pos + 1);
-            aliases[name] = std::move(value);
+            try {
+                auto tokens = lexer(value);
+                aliases[name] = {std::move(value), std::move(tokens)};
+            } catch (const msh_exception &e) {
+                msh_error(doc.name + ": " + name + ": " + e.what());
+                return 1;
+            }
         }
     }
 
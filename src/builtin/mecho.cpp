@@ -11,8 +11,9 @@
  */
 
 #include "internal/msh_builtin.h"
+#include "internal/msh_output.h"
 
-#include <iostream>
+#include <algorithm>
 
 static const builtin_doc doc = {
         .name   = "mecho",
@@ -23,8 +24,10 @@ static const builtin_doc doc = {
 };
 
 int mecho(int argc, char **argv) {
+    // Only options may ask for help, most calls don't need to be parsed
+    bool has_options = std::any_of(argv + 1, argv + argc, [](const char *arg) { return arg[0] == '-'; });
     try {
-        if (handle_help(argc, argv, doc)) {
+        if (has_options && handle_help(argc, argv, doc)) {
             return 0;
         }
     } catch (const std::exception &) {
@@ -32,8 +35,8 @@ int mecho(int argc, char **argv) {
     }
 
     for (int i = 1; i < argc; ++i) {
-        std::cout << argv[i] << " ";
+        msh_out << argv[i] << ' ';
     }
-    std::cout << std::endl;
+    msh_out << '\n';
     return 0;
 }
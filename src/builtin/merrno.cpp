@@ -11,6 +11,7 @@
  */
 
 #include "internal/msh_builtin.h"
+#include "internal/msh_output.h"
 
 #include <iostream>
 
@@ -39,6 +40,6 @@ int merrno(int argc, char **argv) {
         std::cerr << doc.get_usage() << std::endl;
         return 1;
     }
-    std::cout << msh_errno << std::endl;
+    msh_out << msh_errno << '\n';
     return 0;
 }
@@ -14,45 +14,27 @@
 #include "internal/msh_internal.h"
 
 #include <iostream>
-#include <unistd.h>
 
 int mexport(int argc, char **argv) {
     if (argc == 1) {
-        for (int i = 0; environ[i] != nullptr; i++) {
-            std::cout << environ[i] << std::endl;
+        for (auto env = msh_environ(); *env != nullptr; ++env) {
+            std::cout << *env << '\n';
         }
         return 0;
     }
 
     for (int i = 1; i < argc; i++) {
-        auto arg = std::string(argv[i]);
+        auto arg = std::string_view(argv[i]);
         auto pos = arg.find('=');
 
-        std::string var;
-        std::string value;
-
-        if (pos == std::string::npos) {
-            if (auto internal_var = get_variable(arg); internal_var != nullptr) {
-                var = internal_var->name;
-                value = internal_var->value;
+        if (pos == std::string_view::npos) {
+            auto internal_var = get_variable(arg);
+            if (internal_var == nullptr) {
+                return 0;
             }
+            export_variable(*internal_var);
         } else {
-            var = arg.substr(0, pos);
-            value = arg.substr(pos + 1);
-            if (setenv(var.data(), value.data(), 1) != 0) {
-                msh_error(std::string(strerror(errno)) + ": " + var);
-                return 1;
-            }
-            set_variable(var, value);
-        }
-
-        if (var.empty()) {
-            return 0;
-        }
-
-        if (setenv(var.data(), value.data(), 1) != 0) {
-            msh_error(std::string(strerror(errno)) + ": " + var);
-            return 1;
+            export_variable(set_variable(arg.substr(0, pos), std::string{arg.substr(pos + 1)}));
         }
     }
     return 0;
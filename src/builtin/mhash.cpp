@@ -0,0 +1,90 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Built-in command `mhash`.
+ * @ingroup builtin
+ */
+
+#include "internal/msh_builtin.h"
+#include "internal/msh_hash.h"
+
+#include <iomanip>
+#include <boost/program_options.hpp>
+
+static const builtin_doc doc = {
+        .name   = "mhash",
+        .args   = "[-r] [-s] [name ...] [-h|--help]",
+        .brief  = "Remember or display command locations",
+        .doc    = "Without arguments, prints the remembered locations of commands and the number\n"
+                  "of times each of them was used.\n\n"
+                  "If names are given, searches PATH for each of them and remembers the result.\n"
+                  "Options:\n"
+                  "  -r  Forget all remembered locations\n"
+                  "  -s  Print the number of lookups answered from the table (hits)\n"
+                  "      and of PATH searches (misses)\n\n"
+                  "Locations are also forgotten whenever PATH changes.\n"
+                  "Returns 0 unless a command is not found."
+};
+
+int mhash(int argc, char **argv) {
+    namespace po = boost::program_options;
+
+    po::options_description desc("Options");
+    desc.add_options()
+            ("help,h", "Print help message")
+            ("reset,r", "Forget all remembered locations")
+            ("stats,s", "Print lookup statistics")
+            ("names", po::value<std::vector<std::string>>());
+    po::positional_options_description positional;
+    positional.add("names", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        po::notify(vm);
+    } catch (const po::error &e) {
+        msh_error(doc.name + ": " + e.what());
+        std::cerr << doc.get_usage() << std::endl;
+        return 1;
+    }
+
+    if (vm.count("help")) {
+        std::cout << doc.name << " " << doc.args << " -- " << doc.brief << "\n\n" << doc.doc << "\n\n";
+        return 0;
+    }
+
+    if (vm.count("reset")) {
+        hash_clear();
+    }
+
+    int status = 0;
+    if (vm.count("names")) {
+        for (auto const &name: vm["names"].as<std::vector<std::string>>()) {
+            if (name.find('/') != std::string::npos) {
+                continue;
+            }
+            if (hash_add(name) == nullptr) {
+                msh_error(doc.name + ": " + name + ": not found");
+                status = 1;
+            }
+        }
+    }
+
+    if (vm.count("stats")) {
+        std::cout << "hits: " << command_hash_stats.hits << ", misses: " << command_hash_stats.misses << '\n';
+    }
+
+    if (argc == 1) {
+        std::cout << "hits\tcommand\n";
+        for (auto const &[name, entry]: command_hash) {
+            std::cout << std::setw(4) << entry.hits << "\t"
+                      << (entry.path.empty() ? name + ": not found" : entry.path) << '\n';
+        }
+    }
+    return status;
+}
@@ -11,6 +11,7 @@
  */
 
 #include "internal/msh_builtin.h"
+#include "internal/msh_output.h"
 
 #include <iostream>
 #include <cstring>
@@ -44,7 +45,7 @@ int mpwd(int argc, char **argv) {
         msh_error(doc.name + ": " + std::string(strerror(errno)));
         return 1;
     }
-    std::cout << cwd << std::endl;
+    msh_out << cwd << '\n';
     free(cwd);
     return 0;
 }
@@ -0,0 +1,242 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Built-in command `mread`.
+ * @ingroup builtin
+ */
+
+#include "internal/msh_builtin.h"
+#include "internal/msh_expand.h"
+#include "internal/msh_internal.h"
+#include "internal/msh_read.h"
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <vector>
+
+static const builtin_doc doc = {
+        .name   = "mread",
+        .args   = "[-r] [-d delim] [-n count] [-u fd] [name ...] [-h|--help]",
+        .brief  = "Read a line from the standard input and split it into fields",
+        .doc    = "Reads a line from the standard input and splits it into fields by the characters of IFS.\n"
+                  "The first field is assigned to the first name, the second to the second name, and so on,\n"
+                  "the last name gets the rest of the line. Without names the line is assigned to REPLY.\n"
+                  "A backslash removes the special meaning of the next character, a backslash at the end\n"
+                  "of the line continues it on the next one.\n"
+                  "Options:\n"
+                  "  -r        Backslash is an ordinary character\n"
+                  "  -d delim  Read until the first character of delim instead of a newline,\n"
+                  "            until a NUL byte if delim is empty\n"
+                  "  -n count  Read count lines joined by the delimiter\n"
+                  "  -u fd     Read from the file descriptor fd instead of the standard input\n\n"
+                  "Input from regular files is buffered, the unused part is given back to the file\n"
+                  "before any other command can read it.\n"
+                  "Returns 0 unless the end of the file is reached before the first line is complete\n"
+                  "or an error occurs."
+};
+
+namespace {
+    struct read_options {
+        bool raw = false;
+        char delimiter = '\n';
+        size_t count = 1;
+        int fd = STDIN_FILENO;
+        std::vector<std::string_view> names;
+    };
+
+    bool is_name(std::string_view name) {
+        return !name.empty() && !isdigit(name[0]) &&
+               std::ranges::all_of(name, [](char c) { return isalnum(c) || c == '_'; });
+    }
+
+    template<typename T>
+    bool parse_number(std::string_view arg, T &value) {
+        auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+        return ec == std::errc{} && end == arg.data() + arg.size();
+    }
+
+    /**
+     * @brief Parse the options of `mread`.
+     *
+     * @throws std::invalid_argument if the arguments are invalid.
+     */
+    read_options parse_options(int argc, char **argv) {
+        read_options options;
+        int i = 1;
+        for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+            std::string_view option{argv[i]};
+            if (option == "--") {
+                ++i;
+                break;
+            }
+            if (option == "-r") {
+                options.raw = true;
+                continue;
+            }
+
+            std::string_view value;
+            if (option.size() > 2) {
+                value = option.substr(2);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            } else {
+                throw std::invalid_argument(std::string{option} + ": option requires an argument");
+            }
+
+            if (option.starts_with("-d")) {
+                options.delimiter = value.empty() ? '\0' : value.front();
+            } else if (option.starts_with("-n")) {
+                if (!parse_number(value, options.count) || options.count == 0) {
+                    throw std::invalid_argument(std::string{value} + ": invalid count");
+                }
+            } else if (option.starts_with("-u")) {
+                if (!parse_number(value, options.fd) || options.fd < 0) {
+                    throw std::invalid_argument(std::string{value} + ": invalid file descriptor");
+                }
+            } else {
+                throw std::invalid_argument(std::string{option} + ": invalid option");
+            }
+        }
+
+        for (; i < argc; ++i) {
+            if (!is_name(argv[i])) {
+                throw std::invalid_argument(std::string{argv[i]} + ": not a valid identifier");
+            }
+            options.names.emplace_back(argv[i]);
+        }
+        return options;
+    }
+
+    /**
+     * @brief Check whether @p record ends with a backslash that is not escaped itself.
+     */
+    bool ends_with_escape(const std::string &record) {
+        auto last = record.find_last_not_of('\\');
+        auto backslashes = record.size() - (last == std::string::npos ? 0 : last + 1);
+        return backslashes % 2 == 1;
+    }
+
+    /**
+     * @brief Remove the escaping backslashes from @p record.
+     *
+     * @param record The record to unescape in place.
+     * @param escaped Set to the positions of the escaped characters in the unescaped record.
+     */
+    void unescape(std::string &record, std::vector<bool> &escaped) {
+        escaped.assign(record.size(), false);
+        size_t out = 0;
+        for (size_t i = 0; i < record.size(); ++i, ++out) {
+            if (record[i] == '\\' && i + 1 < record.size()) {
+                escaped[out] = true;
+                ++i;
+            }
+            record[out] = record[i];
+        }
+        record.resize(out);
+        escaped.resize(out);
+    }
+
+    /**
+     * @brief Split @p record into fields and assign them to @p names.
+     *
+     * Runs of IFS characters separate fields, the same way as in word splitting. The last name
+     * gets the rest of the record, without the leading and trailing separators.
+     */
+    void assign_fields(std::string_view record, const std::vector<bool> &escaped,
+                       const std::vector<std::string_view> &names) {
+        auto const &ifs = get_ifs();
+        auto is_separator = [&](size_t i) {
+            return ifs.contains(record[i]) && (escaped.empty() || !escaped[i]);
+        };
+
+        size_t pos = 0;
+        for (size_t n = 0; n < names.size(); ++n) {
+            while (pos < record.size() && is_separator(pos)) {
+                ++pos;
+            }
+            auto start = pos;
+            if (n + 1 == names.size()) {
+                pos = record.size();
+                while (pos > start && is_separator(pos - 1)) {
+                    --pos;
+                }
+            } else {
+                while (pos < record.size() && !is_separator(pos)) {
+                    ++pos;
+                }
+            }
+            set_variable(names[n], std::string{record.substr(start, pos - start)});
+        }
+    }
+}
+
+int mread(int argc, char **argv) {
+    bool is_help = argc == 2 && (std::string_view{argv[1]} == "-h" || std::string_view{argv[1]} == "--help");
+    if (is_help) {
+        try {
+            if (handle_help(argc, argv, doc)) {
+                return 0;
+            }
+        } catch (const std::exception &e) {
+            msh_error(doc.name + ": " + e.what());
+            std::cerr << "Usage: " << doc.name << " " << doc.args << std::endl;
+            return 1;
+        }
+    }
+
+    read_options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (const std::invalid_argument &e) {
+        msh_error(doc.name + ": " + e.what());
+        std::cerr << doc.get_usage() << std::endl;
+        return 1;
+    }
+
+    std::string record;
+    bool found = false;
+    try {
+        std::string line;
+        std::string part;
+        for (size_t i = 0; i < options.count; ++i) {
+            line.clear();
+            found = read_record(options.fd, options.delimiter, part);
+            while (!options.raw && found && ends_with_escape(part)) {
+                part.pop_back();
+                line += part;
+                found = read_record(options.fd, options.delimiter, part);
+            }
+            line += part;
+            if (i != 0 && (found || !line.empty())) {
+                record += options.delimiter;
+            }
+            record += line;
+            if (!found) {
+                // Only the first line is required to be complete
+                found = i != 0;
+                break;
+            }
+        }
+    } catch (const msh_exception &e) {
+        msh_error(doc.name + ": " + std::to_string(options.fd) + ": " + e.what());
+        return 1;
+    }
+
+    std::vector<bool> escaped;
+    if (!options.raw && record.find('\\') != std::string::npos) {
+        unescape(record, escaped);
+    }
+
+    if (options.names.empty()) {
+        set_variable("REPLY", std::move(record));
+    } else {
+        assign_fields(record, escaped, options.names);
+    }
+    return found ? 0 : 1;
+}
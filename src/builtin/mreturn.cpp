@@ -0,0 +1,65 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Built-in command `mreturn`.
+ * @ingroup builtin
+ */
+
+#include "internal/msh_builtin.h"
+#include "internal/msh_exec.h"
+#include "internal/msh_internal.h"
+
+#include <iostream>
+
+static const builtin_doc doc = {
+        .name   = "mreturn",
+        .args   = "[code] [-h|--help]",
+        .brief  = "Return from a function",
+        .doc    = "Stops the execution of the current function, which returns a status of code given as\n"
+                  "an argument. If no argument is given the status is the one of the last command executed.\n"
+                  "Returns 1 if not called from a function or given wrong arguments."
+};
+
+int mreturn(int argc, char **argv) {
+    try {
+        if (handle_help(argc, argv, doc)) {
+            return 0;
+        }
+    } catch (const std::exception &e) {
+        msh_error(doc.name + ": " + e.what());
+        std::cerr << "Usage: " << doc.name << " " << doc.args << std::endl;
+        return 1;
+    }
+
+    if (current_frame == nullptr) {
+        msh_error(doc.name + ": can only return from a function");
+        return 1;
+    }
+    if (argc > 2) {
+        msh_error(doc.name + ": wrong number of arguments");
+        std::cerr << doc.get_usage() << std::endl;
+        return 1;
+    }
+
+    int status = msh_errno;
+    if (argc == 2) {
+        try {
+            status = std::stoi(argv[1]);
+        } catch (const std::invalid_argument &) {
+            msh_error(doc.name + ": invalid argument: " + argv[1]);
+            return 1;
+        } catch (const std::out_of_range &) {
+            msh_error(doc.name + ": argument out of range: " + argv[1]);
+            return 1;
+        }
+    }
+
+    current_frame->status = status;
+    exec_returning = true;
+    return status;
+}
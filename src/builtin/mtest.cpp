@@ -0,0 +1,332 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Built-in command `mtest`, also available as `[` and `[[`.
+ * @ingroup builtin
+ */
+
+#include "internal/msh_builtin.h"
+#include "internal/msh_exec.h"
+#include "types/msh_exception.h"
+
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <span>
+#include <string_view>
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const builtin_doc doc = {
+        .name   = "mtest (or [, [[)",
+        .args   = "<expression> [-h|--help]",
+        .brief  = "Evaluate a conditional expression",
+        .doc    = "Supports file tests (-e, -f, -d, -r, -w, -x, -s, -L, ...), string tests (-z, -n, =, !=, <, >),\n"
+                  "integer comparisons (-eq, -ne, -lt, -le, -gt, -ge), file comparisons (-nt, -ot, -ef),\n"
+                  "! , -a, -o and parentheses.\n"
+                  "`[` requires `]` as the last argument, < and > must be quoted there. `[[` requires `]]` as\n"
+                  "the last argument, its arguments are not split into words nor globbed, < and > are not\n"
+                  "redirections, and the right-hand side of = and != is a pattern.\n"
+                  "Returns 0 if the expression is true, 1 if it is false, 2 on error."
+};
+
+namespace {
+    /**
+     * @brief Recursive descent evaluator of a conditional expression.
+     *
+     * Precedence from the lowest: `-o`, `-a`, `!`, then parentheses and primaries.
+     */
+    class test_expression {
+    public:
+        test_expression(std::span<char *const> args, bool patterns) : args(args), patterns(patterns) {}
+
+        bool evaluate() {
+            if (args.empty()) {
+                return false;
+            }
+            auto res = parse_or();
+            if (pos != args.size()) {
+                throw msh_exception("unexpected argument: " + std::string{args[pos]});
+            }
+            return res;
+        }
+
+    private:
+        std::span<char *const> args;
+        bool patterns; ///< Whether the arguments come from `[[`, with quoted pattern characters escaped
+        size_t pos = 0;
+
+        [[nodiscard]] size_t remaining() const {
+            return args.size() - pos;
+        }
+
+        [[nodiscard]] bool at(std::string_view arg) const {
+            return pos < args.size() && args[pos] == arg;
+        }
+
+        bool parse_or() {
+            auto res = parse_and();
+            while (at("-o")) {
+                ++pos;
+                res = parse_and() || res;
+            }
+            return res;
+        }
+
+        bool parse_and() {
+            auto res = parse_not();
+            while (at("-a")) {
+                ++pos;
+                res = parse_not() && res;
+            }
+            return res;
+        }
+
+        bool parse_not() {
+            if (at("!") && remaining() > 1) {
+                ++pos;
+                return !parse_not();
+            }
+            return parse_primary();
+        }
+
+        bool parse_primary() {
+            if (remaining() == 0) {
+                // E.g. a trailing `-a`, `-o` or `!`
+                throw msh_exception("argument expected");
+            }
+            if (remaining() >= 3 && is_binary(args[pos + 1])) {
+                auto lhs = args[pos], op = args[pos + 1], rhs = args[pos + 2];
+                pos += 3;
+                return binary(op, lhs, rhs);
+            }
+            if (at("(") && remaining() > 1) {
+                ++pos;
+                auto res = parse_or();
+                if (!at(")")) {
+                    throw msh_exception("expected `)'");
+                }
+                ++pos;
+                return res;
+            }
+            if (remaining() >= 2 && is_unary(args[pos])) {
+                auto op = args[pos], operand = args[pos + 1];
+                pos += 2;
+                return unary(op[1], operand);
+            }
+            return !operand(args[pos++]).empty();
+        }
+
+        static bool is_unary(std::string_view op) {
+            return op.size() == 2 && op[0] == '-' && std::string_view{"bcdefghLkprsStuwxznOG"}.find(op[1]) != std::string_view::npos;
+        }
+
+        static bool is_binary(std::string_view op) {
+            return op == "=" || op == "==" || op == "!=" || op == "<" || op == ">" ||
+                   op == "-eq" || op == "-ne" || op == "-lt" || op == "-le" || op == "-gt" || op == "-ge" ||
+                   op == "-nt" || op == "-ot" || op == "-ef";
+        }
+
+        /**
+         * @brief Remove the escapes of pattern characters added for `[[`.
+         */
+        [[nodiscard]] std::string operand(std::string_view arg) const {
+            if (!patterns) {
+                return std::string{arg};
+            }
+            std::string res;
+            res.reserve(arg.size());
+            for (size_t i = 0; i < arg.size(); ++i) {
+                if (arg[i] == '\\' && i + 1 < arg.size()) {
+                    ++i;
+                }
+                res += arg[i];
+            }
+            return res;
+        }
+
+        static int64_t integer(std::string_view arg) {
+            while (!arg.empty() && isspace(static_cast<unsigned char>(arg.front()))) {
+                arg.remove_prefix(1);
+            }
+            while (!arg.empty() && isspace(static_cast<unsigned char>(arg.back()))) {
+                arg.remove_suffix(1);
+            }
+            if (arg.starts_with('+')) {
+                arg.remove_prefix(1);
+            }
+            int64_t res = 0;
+            auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), res);
+            if (arg.empty() || ec != std::errc{} || end != arg.data() + arg.size()) {
+                throw msh_exception("integer expression expected: " + std::string{arg});
+            }
+            return res;
+        }
+
+        /**
+         * @brief Check whether @p fd is a terminal, as seen by the command if it is executed
+         * in-process with its output captured.
+         */
+        static bool is_terminal(int fd) {
+            if (exec_captured_in != -1 && fd == STDOUT_FILENO) {
+                return false;
+            }
+            if (exec_captured_in != -1 && fd == STDIN_FILENO) {
+                return isatty(exec_captured_in);
+            }
+            return isatty(fd);
+        }
+
+        bool unary(char op, std::string_view arg) const {
+            auto path = operand(arg);
+            struct stat st{};
+            switch (op) {
+                case 'z':
+                    return path.empty();
+                case 'n':
+                    return !path.empty();
+                case 't':
+                    return is_terminal(static_cast<int>(integer(path)));
+                case 'r':
+                    return faccessat(AT_FDCWD, path.c_str(), R_OK, AT_EACCESS) == 0;
+                case 'w':
+                    return faccessat(AT_FDCWD, path.c_str(), W_OK, AT_EACCESS) == 0;
+                case 'x':
+                    return faccessat(AT_FDCWD, path.c_str(), X_OK, AT_EACCESS) == 0;
+                case 'h':
+                case 'L':
+                    return fstatat(AT_FDCWD, path.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode);
+                default:
+                    break;
+            }
+
+            if (fstatat(AT_FDCWD, path.c_str(), &st, 0) != 0) {
+                return false;
+            }
+            switch (op) {
+                case 'e':
+                    return true;
+                case 'f':
+                    return S_ISREG(st.st_mode);
+                case 'd':
+                    return S_ISDIR(st.st_mode);
+                case 'b':
+                    return S_ISBLK(st.st_mode);
+                case 'c':
+                    return S_ISCHR(st.st_mode);
+                case 'p':
+                    return S_ISFIFO(st.st_mode);
+                case 'S':
+                    return S_ISSOCK(st.st_mode);
+                case 's':
+                    return st.st_size > 0;
+                case 'g':
+                    return st.st_mode & S_ISGID;
+                case 'u':
+                    return st.st_mode & S_ISUID;
+                case 'k':
+                    return st.st_mode & S_ISVTX;
+                case 'O':
+                    return st.st_uid == geteuid();
+                case 'G':
+                    return st.st_gid == getegid();
+                default:
+                    return false;
+            }
+        }
+
+        bool binary(std::string_view op, std::string_view lhs_arg, std::string_view rhs_arg) const {
+            auto lhs = operand(lhs_arg);
+            if (op == "=" || op == "==" || op == "!=") {
+                bool equal = patterns ? fnmatch(std::string{rhs_arg}.c_str(), lhs.c_str(), 0) == 0
+                                      : lhs == rhs_arg;
+                return equal == (op != "!=");
+            }
+
+            auto rhs = operand(rhs_arg);
+            if (op == "<") {
+                return lhs < rhs;
+            }
+            if (op == ">") {
+                return lhs > rhs;
+            }
+            if (op == "-nt" || op == "-ot" || op == "-ef") {
+                struct stat lhs_st{}, rhs_st{};
+                bool lhs_exists = fstatat(AT_FDCWD, lhs.c_str(), &lhs_st, 0) == 0;
+                bool rhs_exists = fstatat(AT_FDCWD, rhs.c_str(), &rhs_st, 0) == 0;
+                if (op == "-ef") {
+                    return lhs_exists && rhs_exists && lhs_st.st_dev == rhs_st.st_dev && lhs_st.st_ino == rhs_st.st_ino;
+                }
+                if (op == "-ot") {
+                    std::swap(lhs_exists, rhs_exists);
+                    std::swap(lhs_st, rhs_st);
+                }
+                if (!lhs_exists || !rhs_exists) {
+                    return lhs_exists;
+                }
+                auto const &l = lhs_st.st_mtim, &r = rhs_st.st_mtim;
+                return l.tv_sec > r.tv_sec || (l.tv_sec == r.tv_sec && l.tv_nsec > r.tv_nsec);
+            }
+
+            auto l = integer(lhs), r = integer(rhs);
+            if (op == "-eq") {
+                return l == r;
+            }
+            if (op == "-ne") {
+                return l != r;
+            }
+            if (op == "-lt") {
+                return l < r;
+            }
+            if (op == "-le") {
+                return l <= r;
+            }
+            if (op == "-gt") {
+                return l > r;
+            }
+            return l >= r;
+        }
+    };
+}
+
+int mtest(int argc, char **argv) {
+    std::string name = argv[0];
+    bool is_help = argc == 2 && (std::string_view{argv[1]} == "-h" || std::string_view{argv[1]} == "--help");
+    if (name == "mtest" && is_help) {
+        try {
+            if (handle_help(argc, argv, doc)) {
+                return 0;
+            }
+        } catch (const std::exception &e) {
+            msh_error(doc.name + ": " + e.what());
+            std::cerr << "Usage: " << doc.name << " " << doc.args << std::endl;
+            return 2;
+        }
+    }
+
+    std::span<char *const> args{argv + 1, static_cast<size_t>(argc - 1)};
+    bool patterns = name == "[[";
+    if (name == "[" || patterns) {
+        std::string_view closing = patterns ? "]]" : "]";
+        if (args.empty() || args.back() != closing) {
+            msh_error(name + ": missing `" + std::string{closing} + "'");
+            return 2;
+        }
+        args = args.first(args.size() - 1);
+    }
+
+    try {
+        return test_expression(args, patterns).evaluate() ? 0 : 1;
+    } catch (const msh_exception &e) {
+        msh_error(name + ": " + e.what());
+        return 2;
+    }
+}
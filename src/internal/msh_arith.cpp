@@ -0,0 +1,527 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Arithmetic expansion.
+ *
+ * Evaluates `$(( ))` expressions in-process with a recursive descent parser over signed
+ * 64-bit integers. Operators and their precedence follow the shell command language,
+ * from the lowest:
+ * <li> `,` </li>
+ * <li> `=` `*=` `/=` `%=` `+=` `-=` `<<=` `>>=` `&=` `^=` `|=` </li>
+ * <li> `?:` </li>
+ * <li> `||`, then `&&`, `|`, `^`, `&` </li>
+ * <li> `==` `!=`, then `<` `<=` `>` `>=` </li>
+ * <li> `<<` `>>`, then `+` `-`, then `*` `/` `%`, then `**` </li>
+ * <li> unary `+` `-` `!` `~` `++` `--`, postfix `++` `--` </li>
+ *
+ * Overflow, division by zero and invalid shift counts are errors rather than wrapping.
+ */
+
+#include "internal/msh_arith.h"
+#include "internal/msh_internal.h"
+#include "types/msh_exception.h"
+
+#include <cctype>
+#include <climits>
+
+namespace {
+    /**
+     * @brief Maximum depth of variables whose values are expressions themselves.
+     */
+    constexpr int MAX_VARIABLE_DEPTH = 64;
+
+    /**
+     * @brief Maximum nesting of parentheses and of operators parsed recursively, e.g. unary ones.
+     * Variables whose values are expressions count towards the nesting where they are used.
+     */
+    constexpr int MAX_NESTING_DEPTH = 1024;
+
+    class arith_parser {
+    public:
+        arith_parser(std::string_view expression, int depth, int nesting = 0) :
+                input(expression), depth(depth), nesting(nesting) {}
+
+        int64_t parse() {
+            auto value = comma();
+            skip_spaces();
+            if (pos != input.size()) {
+                error("syntax error: invalid token `" + std::string{input.substr(pos)} + "'");
+            }
+            return value;
+        }
+
+    private:
+        std::string_view input;
+        size_t pos = 0;
+        int depth;
+        int nesting;
+        int skip = 0; ///< Nesting of operands that are parsed but not evaluated, e.g. the rhs of `0 && x++`
+
+        [[noreturn]] void error(const std::string &message) const {
+            throw msh_exception("arithmetic: " + message + " (expression: `" + std::string{input} + "')");
+        }
+
+        /**
+         * @brief One more level of nesting for the lifetime of the object, so that deeply nested
+         * input is reported instead of overflowing the stack.
+         */
+        class nesting_level {
+        public:
+            explicit nesting_level(arith_parser &parser) : parser(parser) {
+                if (++parser.nesting > MAX_NESTING_DEPTH) {
+                    parser.error("expression recursion level exceeded");
+                }
+            }
+
+            ~nesting_level() {
+                --parser.nesting;
+            }
+
+            nesting_level(const nesting_level &) = delete;
+            nesting_level &operator=(const nesting_level &) = delete;
+
+        private:
+            arith_parser &parser;
+        };
+
+        void skip_spaces() {
+            while (pos < input.size() && isspace(static_cast<unsigned char>(input[pos]))) {
+                ++pos;
+            }
+        }
+
+        /**
+         * @brief Consume @p op if it is next, but not if it is the beginning of a longer operator.
+         */
+        bool accept(std::string_view op, std::string_view not_followed_by = {}) {
+            skip_spaces();
+            if (!input.substr(pos).starts_with(op)) {
+                return false;
+            }
+            if (pos + op.size() < input.size() && not_followed_by.find(input[pos + op.size()]) != std::string_view::npos) {
+                return false;
+            }
+            pos += op.size();
+            return true;
+        }
+
+        void expect(std::string_view op) {
+            if (!accept(op)) {
+                error("syntax error: `" + std::string{op} + "' expected");
+            }
+        }
+
+        void check_overflow(bool overflow) const {
+            if (overflow && !skip) {
+                error("integer overflow");
+            }
+        }
+
+        /**
+         * @brief Apply a binary operator. Errors are not reported for operands that are not evaluated.
+         */
+        int64_t apply(std::string_view op, int64_t lhs, int64_t rhs) const {
+            int64_t res = 0;
+            if (op == "+") {
+                check_overflow(__builtin_add_overflow(lhs, rhs, &res));
+                return res;
+            } else if (op == "-") {
+                check_overflow(__builtin_sub_overflow(lhs, rhs, &res));
+                return res;
+            } else if (op == "*") {
+                check_overflow(__builtin_mul_overflow(lhs, rhs, &res));
+                return res;
+            } else if (op == "/" || op == "%") {
+                if (rhs == 0) {
+                    if (!skip) {
+                        error("division by 0");
+                    }
+                    return 0;
+                }
+                if (lhs == INT64_MIN && rhs == -1) {
+                    check_overflow(op == "/");
+                    return 0;
+                }
+                return op == "/" ? lhs / rhs : lhs % rhs;
+            } else if (op == "<<" || op == ">>") {
+                if (rhs < 0 || rhs >= 64) {
+                    if (!skip) {
+                        error("invalid shift count " + std::to_string(rhs));
+                    }
+                    return 0;
+                }
+                if (op == ">>") {
+                    return lhs >> rhs;
+                }
+                res = static_cast<int64_t>(static_cast<uint64_t>(lhs) << rhs);
+                check_overflow((res >> rhs) != lhs);
+                return res;
+            } else if (op == "**") {
+                if (rhs < 0) {
+                    if (!skip) {
+                        error("exponent less than 0");
+                    }
+                    return 0;
+                }
+                res = 1;
+                bool overflow = false;
+                for (; rhs > 0 && !overflow; rhs >>= 1) {
+                    if (rhs & 1) {
+                        overflow |= __builtin_mul_overflow(res, lhs, &res);
+                    }
+                    if (rhs > 1) {
+                        overflow |= __builtin_mul_overflow(lhs, lhs, &lhs);
+                    }
+                }
+                check_overflow(overflow);
+                return res;
+            } else if (op == "&") {
+                return lhs & rhs;
+            } else if (op == "^") {
+                return lhs ^ rhs;
+            } else if (op == "|") {
+                return lhs | rhs;
+            }
+            error("unknown operator " + std::string{op});
+        }
+
+        int64_t get(std::string_view name) const {
+            auto var = get_variable(name);
+            if (var == nullptr || var->value.empty()) {
+                return 0;
+            }
+            if (depth >= MAX_VARIABLE_DEPTH) {
+                error("expression recursion level exceeded");
+            }
+            return arith_parser(var->value, depth + 1, nesting).parse();
+        }
+
+        int64_t set(std::string_view name, int64_t value) const {
+            if (!skip) {
+                set_variable(name, std::to_string(value));
+            }
+            return value;
+        }
+
+        std::string_view identifier() {
+            skip_spaces();
+            auto start = pos;
+            if (pos < input.size() && (isalpha(static_cast<unsigned char>(input[pos])) || input[pos] == '_')) {
+                while (pos < input.size() && (isalnum(static_cast<unsigned char>(input[pos])) || input[pos] == '_')) {
+                    ++pos;
+                }
+            }
+            return input.substr(start, pos - start);
+        }
+
+        int64_t comma() {
+            auto value = assignment();
+            while (accept(",")) {
+                value = assignment();
+            }
+            return value;
+        }
+
+        int64_t assignment() {
+            auto start = pos;
+            auto name = identifier();
+            if (!name.empty()) {
+                static constexpr std::string_view ops[] = {"*=", "/=", "%=", "+=", "-=", "<<=", ">>=", "&=", "^=", "|="};
+                if (accept("=", "=")) {
+                    nesting_level level(*this);
+                    return set(name, assignment());
+                }
+                for (auto op: ops) {
+                    if (accept(op)) {
+                        nesting_level level(*this);
+                        auto rhs = assignment();
+                        return set(name, apply(op.substr(0, op.size() - 1), skip ? 0 : get(name), rhs));
+                    }
+                }
+            }
+            pos = start;
+            return conditional();
+        }
+
+        int64_t conditional() {
+            auto condition = logical_or();
+            if (!accept("?")) {
+                return condition;
+            }
+            nesting_level level(*this);
+            skip += condition == 0;
+            auto if_true = comma();
+            skip -= condition == 0;
+            expect(":");
+            skip += condition != 0;
+            auto if_false = conditional();
+            skip -= condition != 0;
+            return condition ? if_true : if_false;
+        }
+
+        int64_t logical_or() {
+            auto value = logical_and();
+            while (accept("||")) {
+                skip += value != 0;
+                auto rhs = logical_and();
+                skip -= value != 0;
+                value = value || rhs;
+            }
+            return value;
+        }
+
+        int64_t logical_and() {
+            auto value = bitwise_or();
+            while (accept("&&")) {
+                skip += value == 0;
+                auto rhs = bitwise_or();
+                skip -= value == 0;
+                value = value && rhs;
+            }
+            return value;
+        }
+
+        int64_t bitwise_or() {
+            auto value = bitwise_xor();
+            while (accept("|", "|=")) {
+                value = apply("|", value, bitwise_xor());
+            }
+            return value;
+        }
+
+        int64_t bitwise_xor() {
+            auto value = bitwise_and();
+            while (accept("^", "=")) {
+                value = apply("^", value, bitwise_and());
+            }
+            return value;
+        }
+
+        int64_t bitwise_and() {
+            auto value = equality();
+            while (accept("&", "&=")) {
+                value = apply("&", value, equality());
+            }
+            return value;
+        }
+
+        int64_t equality() {
+            auto value = relational();
+            while (true) {
+                if (accept("==")) {
+                    value = value == relational();
+                } else if (accept("!=")) {
+                    value = value != relational();
+                } else {
+                    return value;
+                }
+            }
+        }
+
+        int64_t relational() {
+            auto value = shift();
+            while (true) {
+                if (accept("<=")) {
+                    value = value <= shift();
+                } else if (accept(">=")) {
+                    value = value >= shift();
+                } else if (accept("<", "<")) {
+                    value = value < shift();
+                } else if (accept(">", ">")) {
+                    value = value > shift();
+                } else {
+                    return value;
+                }
+            }
+        }
+
+        int64_t shift() {
+            auto value = additive();
+            while (true) {
+                if (accept("<<", "=")) {
+                    value = apply("<<", value, additive());
+                } else if (accept(">>", "=")) {
+                    value = apply(">>", value, additive());
+                } else {
+                    return value;
+                }
+            }
+        }
+
+        int64_t additive() {
+            auto value = multiplicative();
+            while (true) {
+                if (accept("+", "+=")) {
+                    value = apply("+", value, multiplicative());
+                } else if (accept("-", "-=")) {
+                    value = apply("-", value, multiplicative());
+                } else {
+                    return value;
+                }
+            }
+        }
+
+        int64_t multiplicative() {
+            auto value = power();
+            while (true) {
+                if (accept("*", "*=")) {
+                    value = apply("*", value, power());
+                } else if (accept("/", "=")) {
+                    value = apply("/", value, power());
+                } else if (accept("%", "=")) {
+                    value = apply("%", value, power());
+                } else {
+                    return value;
+                }
+            }
+        }
+
+        int64_t power() {
+            auto value = unary();
+            if (accept("**", "=")) {
+                nesting_level level(*this);
+                return apply("**", value, power());
+            }
+            return value;
+        }
+
+        int64_t unary() {
+            nesting_level level(*this);
+            if (accept("++") || accept("--")) {
+                bool increment = input[pos - 1] == '+';
+                auto name = identifier();
+                if (name.empty()) {
+                    error("syntax error: identifier expected after " + std::string(increment ? "++" : "--"));
+                }
+                return set(name, apply(increment ? "+" : "-", skip ? 0 : get(name), 1));
+            }
+            if (accept("+")) {
+                return unary();
+            }
+            if (accept("-")) {
+                return apply("-", 0, unary());
+            }
+            if (accept("!", "=")) {
+                return !unary();
+            }
+            if (accept("~")) {
+                return ~unary();
+            }
+            return postfix();
+        }
+
+        int64_t postfix() {
+            skip_spaces();
+            auto name = identifier();
+            if (name.empty()) {
+                return primary();
+            }
+            auto value = skip ? 0 : get(name);
+            if (accept("++")) {
+                set(name, apply("+", value, 1));
+            } else if (accept("--")) {
+                set(name, apply("-", value, 1));
+            }
+            return value;
+        }
+
+        int64_t primary() {
+            if (accept("(")) {
+                nesting_level level(*this);
+                auto value = comma();
+                expect(")");
+                return value;
+            }
+            skip_spaces();
+            if (pos == input.size() || input[pos] == ')') {
+                error("syntax error: operand expected");
+            }
+            if (!isdigit(static_cast<unsigned char>(input[pos]))) {
+                error("syntax error: invalid token `" + std::string{input.substr(pos)} + "'");
+            }
+            return number();
+        }
+
+        /**
+         * @brief Parse a decimal, octal (leading `0`), hexadecimal (leading `0x`) or `base#digits` constant.
+         */
+        int64_t number() {
+            auto start = pos;
+            int base = 10;
+            if (input[pos] == '0' && pos + 1 < input.size() && (input[pos + 1] == 'x' || input[pos + 1] == 'X')) {
+                base = 16;
+                pos += 2;
+            } else if (input[pos] == '0') {
+                base = 8;
+            }
+
+            auto hash = input.find('#', pos);
+            auto digits_end = input.find_first_not_of("0123456789", pos);
+            if (base == 10 && hash != std::string_view::npos && hash == digits_end) {
+                base = 0;
+                for (; pos < hash && base <= 64; ++pos) {
+                    base = base * 10 + (input[pos] - '0');
+                }
+                if (base < 2 || base > 64) {
+                    error("invalid arithmetic base " + std::to_string(base));
+                }
+                pos = hash + 1;
+            }
+
+            int64_t value = 0;
+            auto digits_start = pos;
+            for (; pos < input.size(); ++pos) {
+                auto c = input[pos];
+                int digit;
+                if (isdigit(static_cast<unsigned char>(c))) {
+                    digit = c - '0';
+                } else if (islower(static_cast<unsigned char>(c))) {
+                    digit = c - 'a' + 10;
+                } else if (isupper(static_cast<unsigned char>(c))) {
+                    digit = c - 'A' + (base <= 36 ? 10 : 36);
+                } else if (c == '@' || c == '_') {
+                    digit = c == '@' ? 62 : 63;
+                } else {
+                    break;
+                }
+                if (digit >= base) {
+                    error("value too great for base `" + std::string{input.substr(start, pos - start + 1)} + "'");
+                }
+                if (__builtin_mul_overflow(value, base, &value) || __builtin_add_overflow(value, digit, &value)) {
+                    error("integer overflow");
+                }
+            }
+            if (pos == digits_start && base != 8) {
+                error("syntax error: invalid number `" + std::string{input.substr(start, pos - start)} + "'");
+            }
+            return value;
+        }
+    };
+}
+
+/**
+ * @brief Evaluate an arithmetic expression.
+ *
+ * Variables are read from and assigned to the internal variable table. The value of a
+ * variable is evaluated as an expression itself, unset and empty variables are 0.
+ * Parameter expansion has to be performed on @p expression beforehand.
+ *
+ * @param expression The expression to evaluate.
+ * @return The value of the expression, 0 for an empty expression.
+ *
+ * @throws msh_exception on a syntax error, overflow, division by zero or an invalid shift count.
+ *
+ * @see get_variable
+ * @see set_variable
+ */
+int64_t evaluate_arithmetic(std::string_view expression) {
+    if (expression.find_first_not_of(" \t\n") == std::string_view::npos) {
+        return 0;
+    }
+    return arith_parser(expression, 0).parse();
+}
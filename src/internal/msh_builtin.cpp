@@ -18,18 +18,24 @@
  *
  * Maps command names to their corresponding built-in commands.
  */
-const std::map<std::string, builtin> builtin_commands = {
-        {"merrno",   {&merrno,   0}},
-        {"mpwd",     {&mpwd,     0}},
+const std::map<std::string, builtin, std::less<>> builtin_commands = {
+        {"merrno",   {&merrno,   NO_SIDE_EFFECTS}},
+        {"mpwd",     {&mpwd,     NO_SIDE_EFFECTS}},
         {"mcd",      {&mcd,      0}},
         {"mexit",    {&mexit,    0}},
-        {"mecho",    {&mecho,    0}},
+        {"mecho",    {&mecho,    NO_SIDE_EFFECTS}},
         {"mexport",  {&mexport,  DECLARATION_COMMAND}},
         {"msource",  {&msource,  0}},
         {".",        {&msource,  0}},
         {"malias",   {&malias,   DECLARATION_COMMAND}},
         {"munalias", {&munalias, 0}},
-        {"mjobs",    {&mjobs,    0}},
+        {"mjobs",    {&mjobs,    NO_SIDE_EFFECTS}},
+        {"mhash",    {&mhash,    0}},
+        {"mreturn",  {&mreturn,  0}},
+        {"mread",    {&mread,    0}},
+        {"mtest",    {&mtest,    NO_SIDE_EFFECTS}},
+        {"[",        {&mtest,    NO_SIDE_EFFECTS}},
+        {"[[",       {&mtest,    NO_SIDE_EFFECTS | CONDITIONAL_COMMAND}},
 };
 
 /**
@@ -37,7 +43,7 @@ const std::map<std::string, builtin> builtin_commands = {
  *
  * Maps alias names to their corresponding commands.
  */
-std::map<std::string, std::string> aliases;
+alias_table_t aliases;
 
 /**
  * @brief Check if a command is a built-in command.
@@ -13,18 +13,23 @@
 #include "internal/msh_exec.h"
 #include "internal/msh_parser.h"
 #include "internal/msh_jobs.h"
+#include "internal/msh_internal.h"
+#include "internal/msh_hash.h"
+#include "internal/msh_spawn.h"
+#include "internal/msh_output.h"
+#include "internal/msh_read.h"
 
 #include <unistd.h>
+#include <array>
 #include <cstring>
 #include <fstream>
+#include <utility>
+#include <csignal>
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 
 
-// Define GNU extension for execvpe on some systems
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE
-#endif
-
 /**
  * @brief The current line number of the script being executed.
  *
@@ -43,6 +48,110 @@ int exec_line_no = 0;
  */
 std::string exec_path;
 
+/**
+ * @brief PID of the last process launched by msh_exec_simple(), -1 if the last command
+ * didn't launch a process.
+ */
+pid_t last_pid = -1;
+
+/**
+ * @brief The process group processes launched by msh_exec_simple() are put into.
+ *
+ * If -1, processes stay in the process group of the shell. If 0, the next launched process
+ * becomes the leader of a new process group.
+ *
+ * @see pipeline_command
+ */
+pid_t exec_pgid = -1;
+
+/**
+ * @brief Captured output of in-process builtins.
+ *
+ * If not @c nullptr, builtins flagged as NO_SIDE_EFFECTS are executed in the shell process
+ * instead of a forked child, even if their output goes to a pipe. Their standard output is
+ * appended to the pointed string instead, and it's up to the caller to deliver it.
+ *
+ * @see pipeline_command
+ * @see msh_exec_captured
+ */
+std::string *exec_capture = nullptr;
+
+/**
+ * @brief Standard input of the builtin being executed in-process with its output captured,
+ * -1 otherwise. Its standard output is the capture, never a terminal.
+ *
+ * Lets `mtest -t` check the descriptors the builtin was given rather than those of the shell.
+ *
+ * @see msh_exec_captured
+ */
+int exec_captured_in = -1;
+
+/**
+ * @brief Set by `mreturn`, cleared once the function returns.
+ *
+ * While set, lists, loops and conditionals don't execute any more commands, so execution
+ * unwinds back to msh_call_function().
+ *
+ * @see mreturn
+ */
+bool exec_returning = false;
+
+/**
+ * @brief Executes the lines returned by @p next_line one by one.
+ *
+ * A command spanning several lines, e.g. a loop, is executed once its last line is read.
+ * The body of a here-document is read up to its delimiter before the input is parsed again.
+ *
+ * exec_line_no is incremented for every line read.
+ *
+ * @param next_line Called with the string to read the next line into, returns false at the
+ * end of the input.
+ */
+template<typename LineReader>
+static void exec_lines(LineReader &&next_line) {
+    std::string line;
+    std::string input;
+    std::string delimiter;
+
+    while (next_line(line)) {
+        ++exec_line_no;
+        input += line;
+        if (!delimiter.empty()) {
+            // The input can't be parsed before the end of the here-document
+            auto start = std::min(line.find_first_not_of('\t'), line.size());
+            if (std::string_view{line}.substr(start) != delimiter) {
+                input += '\n';
+                continue;
+            }
+            delimiter.clear();
+        }
+        command cmd;
+        try {
+            cmd = parse_input(input);
+        } catch (const msh_incomplete_input &e) {
+            input += '\n';
+            delimiter = e.get_delimiter();
+            continue;
+        } catch (const msh_exception &e) {
+            msh_error(e.what());
+            msh_errno = e.code();
+            input.clear();
+            continue;
+        }
+        input.clear();
+        cmd.execute();
+        if (exec_returning) {
+            // `mreturn` in a script sourced by a function returns from the function
+            break;
+        }
+    }
+
+    if (!input.empty()) {
+        msh_error("unexpected end of file");
+        msh_errno = INTERNAL_ERROR;
+    }
+}
+
 /**
  * @brief Executes a script line by line.
  *
@@ -55,71 +164,218 @@ std::string exec_path;
  * @return Exit status of the script.
  *
  * @see msh_execve
+ * @see exec_lines
  */
 int msh_exec_script(const char *path) {
     std::ifstream script(path);
-    std::string line;
 
     exec_path = path;
     exec_line_no = 0;
 
-    while (std::getline(script, line)) {
-        ++exec_line_no;
+    exec_lines([&script](std::string &line) {
+        return static_cast<bool>(std::getline(script, line));
+    });
+    return 0;
+}
+
+/**
+ * @brief Executes the commands read from the standard input, if it is not a terminal.
+ *
+ * The lines are read with read_record(): in blocks from a regular file, with the unused part
+ * given back before another command may read it, and byte by byte from a pipe. Either way,
+ * commands reading the standard input themselves get the rest of it, as if it were typed.
+ *
+ * @return Exit status of the last command.
+ *
+ * @see exec_lines
+ */
+int msh_exec_stdin() {
+    exec_path = "stdin";
+    exec_line_no = 0;
+
+    bool more = true;
+    exec_lines([&more](std::string &line) {
+        if (!more) {
+            return false;
+        }
         try {
-            auto command = parse_input(line);
-            command.execute();
+            more = read_record(STDIN_FILENO, '\n', line);
         } catch (const msh_exception &e) {
-            msh_error(e.what());
-            msh_errno = e.code();
+            msh_error(std::string{"stdin: "} + e.what());
+            return false;
         }
-    }
-    return 0;
+        // The last line may lack the newline
+        return more || !line.empty();
+    });
+    return msh_errno;
+}
+
+/**
+ * @brief Executes the commands of @p commands, given with `-c`, line by line.
+ *
+ * @return Exit status of the last command.
+ *
+ * @see exec_lines
+ */
+int msh_exec_string(std::string_view commands) {
+    exec_path = "-c";
+    exec_line_no = 0;
+
+    exec_lines([&commands](std::string &line) {
+        if (commands.empty()) {
+            return false;
+        }
+        auto end = std::min(commands.find('\n'), commands.size());
+        line.assign(commands.substr(0, end));
+        commands.remove_prefix(std::min(end + 1, commands.size()));
+        return true;
+    });
+    return msh_errno;
 }
 
 
+/**
+ * @brief Report the failure to execute a command.
+ *
+ * @param name Name of the command.
+ * @param path Path the command was executed from.
+ * @param error The error code returned by execve().
+ * @return Exit status of the failed command.
+ */
+static int msh_exec_error(const char *name, const char *path, int error) {
+    struct stat st{};
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        msh_error(std::string(name) + ": Is a directory");
+    } else {
+        msh_error(std::string(name) + ": " + strerror(error));
+    }
+    return UNKNOWN_ERROR;
+}
+
 /**
  * @brief Executes a command.
  *
  * @param argv Array of arguments.
+ * @param path Location of the command found in PATH, @c nullptr if it was not found.
+ * Ignored if the command contains a slash.
  * @return Exit status of the command.
  *
  * If command contains a slash, it is executed directly, supposing it is a full path to the
- * executable. Otherwise, the command is searched in the PATH environment variable using execvpe().
+ * executable. Otherwise, the command is executed from the given @p path, which the caller
+ * looks up using hash_lookup().
+ * The command gets the environment block of the exported variables, see msh_environ().
  * If execve() fails and errno is ENOEXEC, the command is treated as a script and executed using
  * msh_exec_script().
  *
  * @see execve
- * @see execvpe
+ * @see hash_lookup
  * @see msh_exec_script
  */
-int msh_execve(char **argv) {
+int msh_execve(char **argv, const char *path) {
     int status = 0;
 
-    if (std::string(argv[0]).find('/') != std::string::npos) {
-        execve(argv[0], argv, environ);
-        if (errno == ENOEXEC) {
-            msh_exec_script(argv[0]);
-        } else {
-            struct stat st{};
-            if (stat(argv[0], &st) == 0 && S_ISDIR(st.st_mode)) {
-                msh_error(std::string(argv[0]) + ": Is a directory");
-                status = UNKNOWN_ERROR;
-            } else {
-                msh_error(std::string(argv[0]) + ": " + strerror(errno));
-                status = UNKNOWN_ERROR;
+    if (strchr(argv[0], '/') != nullptr) {
+        path = argv[0];
+    } else if (path == nullptr) {
+        msh_error("Command not found: " + std::string(argv[0]));
+        return COMMAND_NOT_FOUND;
+    }
+
+    execve(path, argv, msh_environ());
+    if (errno == ENOEXEC) {
+        msh_exec_script(path);
+    } else {
+        status = msh_exec_error(argv[0], path, errno);
+    }
+    return status;
+}
+
+/**
+ * @brief Executes a builtin or a function in the current process.
+ *
+ * @param cmd The command to execute.
+ * @param flags Flags of the command, FUNCTION is set for functions.
+ * @return Exit status of the command.
+ */
+static int msh_exec_builtin(simple_command &cmd, int flags) {
+    if (flags & FUNCTION) {
+        return msh_call_function(std::move(cmd.argv));
+    }
+    return builtin_commands.at(cmd.argv[0]).func(cmd.argc, cmd.argv_c.data());
+}
+
+/**
+ * @brief Executes a builtin in-process, appending its standard output to @c exec_capture.
+ *
+ * @param cmd The command to execute.
+ * @param pipe_in The standard input the builtin would have in a forked process.
+ * @return Exit status of the builtin.
+ *
+ * @see exec_captured_in
+ */
+static int msh_exec_captured(simple_command &cmd, int pipe_in) {
+    auto saved_capture = msh_out.capture(exec_capture);
+    auto saved_in = std::exchange(exec_captured_in, pipe_in);
+    auto status = builtin_commands.at(cmd.argv[0]).func(cmd.argc, cmd.argv_c.data());
+    exec_captured_in = saved_in;
+    msh_out.capture(saved_capture);
+    return status;
+}
+
+/**
+ * @brief Write the whole output to the file descriptor.
+ *
+ * Stops early if the reader has gone away. SIGPIPE is ignored meanwhile.
+ *
+ * @param fd The file descriptor to write to.
+ * @param output The data to write.
+ */
+void msh_write_output(int fd, std::string_view output) {
+    if (fd == STDOUT_FILENO) {
+        msh_out.flush();
+    }
+
+    auto old_handler = signal(SIGPIPE, SIG_IGN);
+    while (!output.empty()) {
+        auto written = write(fd, output.data(), output.size());
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
             }
+            break;
         }
-    } else {
-        execvpe(argv[0], argv, environ);
-        if (errno == ENOENT) {
-            msh_error("Command not found: " + std::string(argv[0]));
-            status = COMMAND_NOT_FOUND;
-        } else {
-            msh_error(strerror(errno));
-            status = UNKNOWN_ERROR;
+        output.remove_prefix(written);
+    }
+    signal(SIGPIPE, old_handler);
+}
+
+/**
+ * @brief Close the file descriptors of the shell in a forked subshell.
+ *
+ * The shell opens its own file descriptors with O_CLOEXEC, e.g. the pipes of a pipeline or
+ * the redirection targets, so that executed commands don't inherit them. A subshell doesn't
+ * exec, and could keep the write end of a pipe open, so its reader would never see the end
+ * of the input, e.g. in `mecho a | while mread l; do ...; done`.
+ *
+ * Must be called once the file descriptors of the subshell itself are in place.
+ */
+void msh_close_shell_fds() {
+    DIR *dir = opendir("/proc/self/fd");
+    if (dir == nullptr) {
+        return;
+    }
+    std::vector<int> fds;
+    while (auto entry = readdir(dir)) {
+        int fd = atoi(entry->d_name);
+        int fd_flags = fd > STDERR_FILENO && fd != dirfd(dir) ? fcntl(fd, F_GETFD) : -1;
+        if (fd_flags != -1 && (fd_flags & FD_CLOEXEC)) {
+            fds.push_back(fd);
         }
     }
-    return status;
+    closedir(dir);
+    for (auto fd: fds) {
+        close(fd);
+    }
 }
 
 /**
@@ -131,40 +387,86 @@ int msh_execve(char **argv) {
  * @param flags Flags to pass to the command.
  * @return Exit status of the command or the error code if any.
  *
- * If the command is a builtin, it is executed directly. Otherwise, it is executed using msh_execve().
+ * If the command is a builtin or a function, it is executed directly. External commands are
+ * launched using msh_spawn(), falling back to msh_execve() in a forked process if it fails.
  *
  * If either pipe_in or pipe_out is not STDIN_FILENO or STDOUT_FILENO respectively,
- * the command is not a builtin, or the command is executed asynchronously, the command will be
- * executed in a forked process.
+ * or the command is executed asynchronously, a builtin will be executed in a forked process.
+ * The exception are builtins flagged as NO_SIDE_EFFECTS without redirections, executed
+ * in-process with the output captured, while @c exec_capture is set.
+ *
+ * The redirections are compiled into a redirect_plan in the shell process, so failing to open
+ * a file is reported before anything is launched, and a child only has to issue dup2() calls.
  *
  * If either ASYNC or FORK_NO_WAIT is set in flags, the parent process returns immediately.
- * One should take care of the child process by calling wait_for_process() or reap_children()
- * explicitly if needed.
+ * One should take care of the child process, available as @c last_pid, by calling
+ * wait_for_process() explicitly if needed.
  *
+ * The launched process is put into the process group @c exec_pgid.
+ *
+ * @see msh_spawn
  * @see msh_execve
  */
 int msh_exec_simple(simple_command &cmd, int pipe_in = STDIN_FILENO, int pipe_out = STDOUT_FILENO, int flags = 0) {
     int status = 0;
     bool to_fork;
-    bool is_builtin = flags & BUILTIN;
+    bool is_builtin = flags & (BUILTIN | FUNCTION);
     bool is_async = flags & ASYNC;
 
     to_fork = pipe_in != STDIN_FILENO || pipe_out != STDOUT_FILENO || !is_builtin || is_async;
 
+    if ((flags & BUILTIN) && exec_capture != nullptr && !(flags & (ASYNC | PIPE_STDERR)) && cmd.redirects.empty() &&
+        builtin_commands.at(cmd.argv[0]).get_flag(NO_SIDE_EFFECTS)) {
+        return msh_exec_captured(cmd, pipe_in);
+    }
+
+    // Opens the redirection targets in the shell, the child only arranges the file descriptors
+    redirect_plan plan;
+    if (auto res = plan.compile(cmd.redirects); res != 0) {
+        return res;
+    }
+
     if (!to_fork) {
         // In this case the command can only be a builtin one
-        std::vector<int> fd_to_close;
-        if (auto res = cmd.do_redirects(&fd_to_close); res != 0) {
-            cmd.undo_redirects(fd_to_close);
+        if (auto res = plan.perform(); res != 0) {
+            plan.undo();
             return res;
         }
-        status = builtin_commands.at(cmd.argv[0]).func(cmd.argc, cmd.argv_c.data());
-        cmd.undo_redirects(fd_to_close);
+        status = msh_exec_builtin(cmd, flags);
+        plan.undo();
         return status;
     }
 
-    pid_t pid = fork();
+    // Make sure the environment block is up to date and the command is looked up in the parent,
+    // so the child doesn't rebuild the block and the lookup result is remembered
+    msh_environ();
+    // The child may read from and write to the same files
+    msh_out.flush();
+    read_buffers_release();
+    const std::string *path = nullptr;
+    if (!is_builtin && strchr(cmd.argv_c[0], '/') == nullptr) {
+        path = hash_lookup(cmd.argv_c[0]);
+    }
+
+    sigchld_guard guard;
+    last_pid = -1;
+    pid_t pid = 0;
+    if (!is_builtin) {
+        pid = msh_spawn(cmd, plan, path != nullptr ? path->c_str() : nullptr, pipe_in, pipe_out, flags);
+    }
+    if (pid == 0) {
+        pid = fork();
+    }
+
     if (pid == 0) {
+        unblock_sigchld();
+        exec_capture = nullptr;
+        if (exec_pgid != -1) {
+            setpgid(0, exec_pgid);
+        }
+        if (flags & PIPE_STDERR) {
+            dup2(pipe_out, STDERR_FILENO);
+        }
         if (pipe_in != STDIN_FILENO) {
             dup2(pipe_in, STDIN_FILENO);
             close(pipe_in);
@@ -173,28 +475,30 @@ int msh_exec_simple(simple_command &cmd, int pipe_in = STDIN_FILENO, int pipe_ou
             dup2(pipe_out, STDOUT_FILENO);
             close(pipe_out);
         }
-        if (auto res = cmd.do_redirects(nullptr); res != 0) {
-            exit(res);
-        }
-
-        if (flags & PIPE_STDERR) {
-            dup2(pipe_out, STDERR_FILENO);
+        if (auto res = plan.apply(); res != 0) {
+            _exit(res);
         }
 
         if (is_builtin) {
-            status = builtin_commands.at(cmd.argv[0]).func(cmd.argc, cmd.argv_c.data());
+            msh_close_shell_fds();
+            status = msh_exec_builtin(cmd, flags);
         } else {
-            status = msh_execve(cmd.argv_c.data());
+            status = msh_execve(cmd.argv_c.data(), path != nullptr ? path->c_str() : nullptr);
         }
         exit(status);
     } else if (pid < 0) {
         msh_error(strerror(errno));
         return UNKNOWN_ERROR;
     } else {
+        if (exec_pgid != -1) {
+            // Also set in the parent, so the group exists before the next process joins it
+            setpgid(pid, exec_pgid == 0 ? pid : exec_pgid);
+        }
+        last_pid = pid;
         add_process(pid, flags, cmd.argv);
 
         if (is_async) {
-            std::cout << "[" << no_background_processes() << "] " << pid << std::endl;
+            msh_out << '[' << no_background_processes() << "] " << pid << '\n';
             return status;
         }
         if (flags & FORK_NO_WAIT) {
@@ -205,6 +509,117 @@ int msh_exec_simple(simple_command &cmd, int pipe_in = STDIN_FILENO, int pipe_ou
     }
 }
 
+/**
+ * @brief Executes a compound command.
+ *
+ * @param cmd The command to execute.
+ * @param in File descriptor to use as stdin.
+ * @param out File descriptor to use as stdout.
+ * @param flags Flags to pass to the command.
+ * @return Exit status of the command or the error code if any.
+ *
+ * The command is executed in-process, unless either @p in or @p out is not STDIN_FILENO or
+ * STDOUT_FILENO respectively, or the command is executed asynchronously. In that case it is
+ * executed in a forked subshell, the same way msh_exec_simple() executes a builtin.
+ *
+ * @see compound_command
+ */
+int msh_exec_compound(compound_command &cmd, int in, int out, int flags) {
+    if (in == STDIN_FILENO && out == STDOUT_FILENO && !(flags & (ASYNC | FORK_NO_WAIT))) {
+        return cmd.run();
+    }
+
+    static constexpr std::array<const char *, 5> names = {"if", "while", "until", "for", "{"};
+    int status = 0;
+
+    // Don't let the child inherit the pending output of the shell, nor the input read ahead
+    msh_out.flush();
+    read_buffers_release();
+
+    sigchld_guard guard;
+    last_pid = -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        unblock_sigchld();
+        exec_capture = nullptr;
+        if (exec_pgid != -1) {
+            setpgid(0, exec_pgid);
+        }
+        // Commands of the subshell stay in its process group
+        exec_pgid = -1;
+        if (flags & PIPE_STDERR) {
+            dup2(out, STDERR_FILENO);
+        }
+        if (in != STDIN_FILENO) {
+            dup2(in, STDIN_FILENO);
+            close(in);
+        }
+        if (out != STDOUT_FILENO) {
+            dup2(out, STDOUT_FILENO);
+            close(out);
+        }
+        msh_close_shell_fds();
+        status = cmd.run();
+        msh_out.flush();
+        exit(status);
+    } else if (pid < 0) {
+        msh_error(strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+
+    if (exec_pgid != -1) {
+        setpgid(pid, exec_pgid == 0 ? pid : exec_pgid);
+    }
+    last_pid = pid;
+    add_process(pid, flags, {cmd.kind == compound_command::FUNCTION ? cmd.variable : names[cmd.kind]});
+
+    if (flags & ASYNC) {
+        msh_out << '[' << no_background_processes() << "] " << pid << '\n';
+        return status;
+    }
+    if (flags & FORK_NO_WAIT) {
+        return status;
+    }
+    return wait_for_process(pid, &status);
+}
+
+/**
+ * @brief Calls a function in the current process.
+ *
+ * The body of the function is executed from its parsed tree, nothing is read or parsed
+ * again. The positional parameters are set to the arguments for the duration of the call,
+ * held by a frame on the stack of this function.
+ *
+ * @param args The name of the function followed by the arguments.
+ * @return Exit status of the last command executed, or the status given to `mreturn`.
+ *
+ * @see call_frame
+ * @see mreturn
+ */
+int msh_call_function(std::vector<std::string> args) {
+    // Keeps the body alive if the function redefines itself
+    auto body = functions.at(args[0]);
+
+    call_frame frame{std::move(args), current_frame};
+    if (current_frame != nullptr) {
+        frame.depth = current_frame->depth + 1;
+    }
+    if (frame.depth > MSH_MAX_CALL_DEPTH) {
+        msh_error(frame.args[0] + ": maximum function nesting level exceeded");
+        return UNKNOWN_ERROR;
+    }
+
+    current_frame = &frame;
+    auto status = body->execute();
+    current_frame = frame.previous;
+
+    if (exec_returning) {
+        exec_returning = false;
+        status = frame.status;
+    }
+    return status;
+}
+
 /**
  * @brief Internal command execution function.
  *
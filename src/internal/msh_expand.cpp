@@ -0,0 +1,1057 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Expansion engine.
+ *
+ * All expansions of a simple command (variables, command substitution, assignments,
+ * filename expansion and squashing of adjacent words) are performed in a single pass
+ * over its tokens by expand_tokens().
+ */
+
+#include "internal/msh_expand.h"
+#include "internal/msh_arith.h"
+#include "internal/msh_builtin.h"
+#include "internal/msh_glob.h"
+#include "internal/msh_internal.h"
+#include "internal/msh_scan.h"
+#include "internal/msh_subst.h"
+#include "types/msh_exception.h"
+
+#include <algorithm>
+#include <charconv>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <vector>
+
+namespace {
+    /**
+     * @brief Delimiters of word splitting, rebuilt only when IFS changes.
+     */
+    std::optional<byte_set> ifs_delimiters;
+
+    /**
+     * @brief Get the positional parameters of the current function, empty outside of functions.
+     */
+    std::span<const std::string> positional_parameters() {
+        if (current_frame == nullptr) {
+            return {};
+        }
+        return std::span{current_frame->args}.subspan(1);
+    }
+
+    /**
+     * @brief Append the value of the special parameter @p name to @p out.
+     *
+     * Supports `$1` to `$9`, `$#`, `$@`, `$*` and `$?`. `$*` joins the positional parameters
+     * with the first byte of IFS, `$@` with a space.
+     *
+     * @return Whether @p name is a special parameter.
+     */
+    bool append_special(std::string &out, char name) {
+        auto args = positional_parameters();
+        if (name >= '1' && name <= '9') {
+            if (auto index = static_cast<size_t>(name - '1'); index < args.size()) {
+                out += args[index];
+            }
+            return true;
+        }
+
+        std::string_view separator = " ";
+        switch (name) {
+            case '#':
+                out += std::to_string(args.size());
+                return true;
+            case '?':
+                out += std::to_string(msh_errno);
+                return true;
+            case '*':
+                if (auto ifs = get_variable("IFS"); ifs != nullptr) {
+                    separator = std::string_view{ifs->value}.substr(0, 1);
+                }
+                [[fallthrough]];
+            case '@':
+                for (size_t i = 0; i < args.size(); ++i) {
+                    if (i != 0) {
+                        out += separator;
+                    }
+                    out += args[i];
+                }
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * @brief Find `$@` in @p value, unless escaped.
+     */
+    size_t find_all_parameters(std::string_view value) {
+        for (auto at = value.find("$@"); at != std::string_view::npos; at = value.find("$@", at + 2)) {
+            if (at == 0 || value[at - 1] != '\\') {
+                return at;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    size_t expand_parameter(std::string &out, std::string_view value, size_t pos);
+
+    /**
+     * @brief Match a single character of a pattern at @p pos: `?`, a bracket expression, an escaped or a literal character.
+     *
+     * @param length Set to the length of the matched pattern element.
+     */
+    bool match_char(std::string_view pattern, size_t pos, char c, size_t &length) {
+        if (pattern[pos] == '?') {
+            length = 1;
+            return true;
+        }
+        if (pattern[pos] == '\\' && pos + 1 < pattern.size()) {
+            length = 2;
+            return pattern[pos + 1] == c;
+        }
+        if (pattern[pos] == '[') {
+            auto i = pos + 1;
+            bool negate = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+            if (negate) {
+                ++i;
+            }
+            bool matched = false;
+            for (auto first = i; i < pattern.size() && (pattern[i] != ']' || i == first); ++i) {
+                auto low = pattern[i];
+                if (low == '\\' && i + 1 < pattern.size()) {
+                    low = pattern[++i];
+                }
+                auto high = low;
+                if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                    high = pattern[i + 2];
+                    i += 2;
+                }
+                matched |= low <= c && c <= high;
+            }
+            if (i < pattern.size()) {
+                length = i - pos + 1;
+                return matched != negate;
+            }
+            // Not closed, a literal `[`
+        }
+        length = 1;
+        return pattern[pos] == c;
+    }
+
+    bool is_literal(std::string_view pattern) {
+        return pattern.find_first_of("*?[\\") == std::string_view::npos;
+    }
+
+    /**
+     * @brief A shell pattern compiled for matching in a single pass over the text.
+     *
+     * Supports `*`, `?`, bracket expressions and backslash escapes. The pattern is split into
+     * elements, each either a `*` or a single character element, see match_char(). All the ways
+     * to align the pattern with the text are followed at once: the state of a scan is the set of
+     * elements the pattern can be at, so matching takes O(text * pattern) time however many `*`
+     * the pattern has, and never backtracks.
+     */
+    class pattern_matcher {
+    public:
+        static constexpr size_t npos = std::string_view::npos;
+
+        /**
+         * @param reversed Match the text from its end, with the elements in reverse order.
+         */
+        pattern_matcher(std::string_view pattern, bool reversed) : pattern(pattern), reversed(reversed) {
+            for (size_t pos = 0; pos < pattern.size();) {
+                size_t length = 1;
+                if (pattern[pos] != '*') {
+                    match_char(pattern, pos, '\0', length);
+                }
+                elements.push_back(pos);
+                pos += length;
+            }
+            if (reversed) {
+                std::reverse(elements.begin(), elements.end());
+            }
+            states.resize(elements.size() + 1);
+            next.resize(elements.size() + 1);
+        }
+
+        /**
+         * @brief Match the pattern at the start of @p text, or at its end if reversed.
+         *
+         * @return Lengths of the shortest and the longest match, npos if there is none.
+         */
+        std::pair<size_t, size_t> anchored(std::string_view text) {
+            std::fill(states.begin(), states.end(), npos);
+            enter(states, 0, 0);
+            size_t shortest = states.back() != npos ? 0 : npos, longest = shortest;
+            for (size_t t = 0; t < text.size() && !empty(); ++t) {
+                step(reversed ? text[text.size() - 1 - t] : text[t]);
+                if (states.back() != npos) {
+                    shortest = std::min(shortest, t + 1);
+                    longest = t + 1;
+                }
+            }
+            return {shortest, longest};
+        }
+
+        /**
+         * @brief Find the leftmost non-empty match in @p text at or after @p pos, the longest one
+         * there.
+         *
+         * A scan starting at every position is followed at once, each state keeping the leftmost
+         * start that reaches it. Once a match is found, no more scans are started, and the
+         * search ends as soon as the scans started at or before it can't go on.
+         *
+         * @return The start and the length of the match, npos if there is none.
+         */
+        std::pair<size_t, size_t> find(std::string_view text, size_t pos) {
+            std::fill(states.begin(), states.end(), npos);
+            size_t match = npos, match_end = npos;
+            for (size_t t = pos;; ++t) {
+                if (match == npos) {
+                    enter(states, 0, t);
+                }
+                auto start = states.back();
+                if (start != npos && start < t && (match == npos || start <= match)) {
+                    match = start;
+                    match_end = t;
+                }
+                if (match != npos) {
+                    for (auto &state: states) {
+                        state = state > match ? npos : state;
+                    }
+                }
+                if (t == text.size() || (match != npos && empty())) {
+                    break;
+                }
+                step(text[t]);
+            }
+            return {match, match == npos ? npos : match_end - match};
+        }
+
+    private:
+        std::string_view pattern;
+        bool reversed;
+        std::vector<size_t> elements; ///< Positions of the elements in the pattern
+        /// The leftmost start of a scan at each element, npos if none. The last one is the end of the pattern.
+        std::vector<size_t> states, next;
+
+        [[nodiscard]] bool is_star(size_t element) const {
+            return pattern[elements[element]] == '*';
+        }
+
+        [[nodiscard]] bool empty() const {
+            return std::all_of(states.begin(), states.end(), [](size_t state) { return state == npos; });
+        }
+
+        /**
+         * @brief Reach @p element from @p start, and the elements following a run of `*` there.
+         */
+        void enter(std::vector<size_t> &to, size_t element, size_t start) const {
+            for (;; ++element) {
+                to[element] = std::min(to[element], start);
+                if (element == elements.size() || !is_star(element)) {
+                    break;
+                }
+            }
+        }
+
+        void step(char c) {
+            std::fill(next.begin(), next.end(), npos);
+            for (size_t i = 0; i < elements.size(); ++i) {
+                size_t length = 0;
+                if (states[i] == npos) {
+                    continue;
+                }
+                if (is_star(i)) {
+                    enter(next, i, states[i]);
+                } else if (match_char(pattern, elements[i], c, length)) {
+                    enter(next, i + 1, states[i]);
+                }
+            }
+            states.swap(next);
+        }
+    };
+
+    /**
+     * @brief Remove the shortest or the longest prefix of @p value matching @p pattern, i.e. `${name#pattern}`.
+     *
+     * Patterns of the form `literal`, `*literal` and `literal*` take a single search, others
+     * a single pass of pattern_matcher.
+     */
+    std::string_view remove_prefix(std::string_view value, std::string_view pattern, bool longest) {
+        if (is_literal(pattern)) {
+            return value.starts_with(pattern) ? value.substr(pattern.size()) : value;
+        }
+        if (pattern.starts_with('*') && is_literal(pattern.substr(1))) {
+            auto literal = pattern.substr(1);
+            auto pos = longest ? value.rfind(literal) : value.find(literal);
+            return pos == std::string_view::npos ? value : value.substr(pos + literal.size());
+        }
+        if (pattern.ends_with('*') && is_literal(pattern.substr(0, pattern.size() - 1))) {
+            auto literal = pattern.substr(0, pattern.size() - 1);
+            if (!value.starts_with(literal)) {
+                return value;
+            }
+            return longest ? value.substr(value.size()) : value.substr(literal.size());
+        }
+
+        auto [shortest_length, longest_length] = pattern_matcher(pattern, false).anchored(value);
+        if (shortest_length == pattern_matcher::npos) {
+            return value;
+        }
+        return value.substr(longest ? longest_length : shortest_length);
+    }
+
+    /**
+     * @brief Remove the shortest or the longest suffix of @p value matching @p pattern, i.e. `${name%pattern}`.
+     *
+     * Patterns of the form `literal`, `*literal` and `literal*` take a single search, others
+     * a single pass of pattern_matcher from the end of the value.
+     */
+    std::string_view remove_suffix(std::string_view value, std::string_view pattern, bool longest) {
+        if (is_literal(pattern)) {
+            return value.ends_with(pattern) ? value.substr(0, value.size() - pattern.size()) : value;
+        }
+        if (pattern.ends_with('*') && is_literal(pattern.substr(0, pattern.size() - 1))) {
+            auto literal = pattern.substr(0, pattern.size() - 1);
+            auto pos = longest ? value.find(literal) : value.rfind(literal);
+            return pos == std::string_view::npos ? value : value.substr(0, pos);
+        }
+        if (pattern.starts_with('*') && is_literal(pattern.substr(1))) {
+            auto literal = pattern.substr(1);
+            if (!value.ends_with(literal)) {
+                return value;
+            }
+            return longest ? value.substr(0, 0) : value.substr(0, value.size() - literal.size());
+        }
+
+        auto [shortest_length, longest_length] = pattern_matcher(pattern, true).anchored(value);
+        if (shortest_length == pattern_matcher::npos) {
+            return value;
+        }
+        return value.substr(0, value.size() - (longest ? longest_length : shortest_length));
+    }
+
+    /**
+     * @brief Append @p value to @p out, replacing the matches of @p pattern with @p replacement.
+     *
+     * Each match is the longest one at the leftmost position, found by a pattern_matcher pass
+     * resumed from the end of the previous match.
+     *
+     * @param mode `/` to replace the first match, `//` all matches, `/#` a match at the start,
+     * `/%` a match at the end.
+     */
+    void append_replaced(std::string &out, std::string_view value, std::string_view pattern,
+                         std::string_view replacement, std::string_view mode) {
+        if (pattern.empty()) {
+            out += value;
+            return;
+        }
+        if (mode == "#" || mode == "%") {
+            auto rest = mode == "#" ? remove_prefix(value, pattern, true) : remove_suffix(value, pattern, true);
+            if (rest.size() == value.size()) {
+                out += value;
+            } else if (mode == "#") {
+                out.append(replacement).append(rest);
+            } else {
+                out.append(rest).append(replacement);
+            }
+            return;
+        }
+
+        bool all = mode == "/";
+        bool literal = is_literal(pattern);
+        std::optional<pattern_matcher> matcher;
+        if (!literal) {
+            matcher.emplace(pattern, false);
+        }
+        size_t pos = 0;
+        while (pos < value.size()) {
+            size_t start, length;
+            if (literal) {
+                start = value.find(pattern, pos);
+                length = pattern.size();
+            } else {
+                std::tie(start, length) = matcher->find(value, pos);
+            }
+            if (start == std::string_view::npos) {
+                break;
+            }
+            out.append(value.substr(pos, start - pos)).append(replacement);
+            pos = start + length;
+            if (!all) {
+                break;
+            }
+        }
+        out += value.substr(std::min(pos, value.size()));
+    }
+
+    /**
+     * @brief Get the length of the name at the start of the body of `${...}`.
+     *
+     * A name is an identifier, a number or a single special character.
+     */
+    size_t name_length(std::string_view body) {
+        if (body.empty()) {
+            return 0;
+        }
+        if (isdigit(static_cast<unsigned char>(body[0]))) {
+            return std::min(body.find_first_not_of("0123456789"), body.size());
+        }
+        if (body[0] == '#' || body[0] == '?' || body[0] == '@' || body[0] == '*') {
+            return 1;
+        }
+        size_t length = 0;
+        while (length < body.size() && (isalnum(static_cast<unsigned char>(body[length])) || body[length] == '_')) {
+            ++length;
+        }
+        return length;
+    }
+
+    /**
+     * @brief Get the value of the parameter @p name.
+     *
+     * @param scratch Holds the value of a special parameter.
+     * @return A view of the value, std::nullopt if the parameter is unset.
+     */
+    std::optional<std::string_view> parameter_value(std::string_view name, std::string &scratch) {
+        if (isdigit(static_cast<unsigned char>(name[0]))) {
+            auto args = positional_parameters();
+            size_t index = 0;
+            std::from_chars(name.data(), name.data() + name.size(), index);
+            if (index == 0 || index > args.size()) {
+                return std::nullopt;
+            }
+            return args[index - 1];
+        }
+        if (name.size() == 1 && append_special(scratch, name[0])) {
+            return scratch;
+        }
+        if (auto var = get_variable(name); var != nullptr) {
+            return var->value;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Expand the operand of a `${...}` operator.
+     *
+     * Handles quotes, backslash escapes and parameters within the operand. In a @p pattern,
+     * backslash escapes are kept and quoted pattern characters are escaped, so they are
+     * matched literally. Operands without anything to expand are returned as is.
+     *
+     * @param storage Holds the expanded operand.
+     */
+    std::string_view expand_operand(std::string_view operand, bool pattern, std::string &storage) {
+        if (operand.find_first_of("$'\"\\") == std::string_view::npos) {
+            return operand;
+        }
+
+        auto append_quoted = [&](std::string_view text) {
+            for (auto c: text) {
+                if (pattern && (c == '*' || c == '?' || c == '[' || c == '\\')) {
+                    storage += '\\';
+                }
+                storage += c;
+            }
+        };
+
+        bool quoted = false;
+        for (size_t i = 0; i < operand.size(); ++i) {
+            auto c = operand[i];
+            if (c == '"') {
+                quoted = !quoted;
+            } else if (c == '\'' && !quoted) {
+                auto end = std::min(operand.find('\'', i + 1), operand.size());
+                append_quoted(operand.substr(i + 1, end - i - 1));
+                i = end;
+            } else if (c == '\\' && i + 1 < operand.size()) {
+                if (pattern && !quoted) {
+                    storage += c;
+                }
+                quoted ? append_quoted(operand.substr(++i, 1)) : void(storage += operand[++i]);
+            } else if (c == '$') {
+                std::string value;
+                i = expand_parameter(value, operand, i) - 1;
+                quoted ? append_quoted(value) : void(storage += value);
+            } else {
+                quoted ? append_quoted(operand.substr(i, 1)) : void(storage += c);
+            }
+        }
+        return storage;
+    }
+
+    /**
+     * @brief Append the expansion of `${body}` to @p out.
+     *
+     * @throws msh_exception if the expansion is invalid or `${name?word}` finds the parameter unset.
+     */
+    void expand_braced(std::string &out, std::string_view body) {
+        auto bad_substitution = [&]() {
+            return msh_exception("${" + std::string{body} + "}: bad substitution");
+        };
+        std::string scratch, storage;
+
+        if (body.size() > 1 && body[0] == '#' && name_length(body.substr(1)) == body.size() - 1) {
+            auto name = body.substr(1);
+            if (name == "@" || name == "*") {
+                out += std::to_string(positional_parameters().size());
+            } else {
+                out += std::to_string(parameter_value(name, scratch).value_or("").size());
+            }
+            return;
+        }
+
+        auto name = body.substr(0, name_length(body));
+        if (name.empty()) {
+            throw bad_substitution();
+        }
+        auto op = body.substr(name.size());
+        auto value = parameter_value(name, scratch);
+        if (op.empty()) {
+            out += value.value_or("");
+            return;
+        }
+
+        bool colon = op[0] == ':' && op.size() > 1 && std::string_view{"-=+?"}.find(op[1]) != std::string_view::npos;
+        if (colon || std::string_view{"-=+?"}.find(op[0]) != std::string_view::npos) {
+            auto kind = op[colon ? 1 : 0];
+            auto word = op.substr(colon ? 2 : 1);
+            bool set = value.has_value() && !(colon && value->empty());
+            if (kind == '+') {
+                out += set ? expand_operand(word, false, storage) : "";
+            } else if (set) {
+                out += *value;
+            } else if (kind == '-') {
+                out += expand_operand(word, false, storage);
+            } else if (kind == '=') {
+                if (!isalpha(static_cast<unsigned char>(name[0])) && name[0] != '_') {
+                    throw msh_exception("$" + std::string{name} + ": cannot assign in this way");
+                }
+                auto expanded = std::string{expand_operand(word, false, storage)};
+                out += expanded;
+                set_variable(name, std::move(expanded));
+            } else {
+                auto message = expand_operand(word, false, storage);
+                throw msh_exception(std::string{name} + ": " +
+                                    (message.empty() ? "parameter null or not set" : std::string{message}));
+            }
+            return;
+        }
+
+        auto text = value.value_or("");
+        switch (op[0]) {
+            case '#':
+            case '%': {
+                bool longest = op.size() > 1 && op[1] == op[0];
+                auto pattern = expand_operand(op.substr(longest ? 2 : 1), true, storage);
+                out += op[0] == '#' ? remove_prefix(text, pattern, longest) : remove_suffix(text, pattern, longest);
+                return;
+            }
+            case '/': {
+                auto rest = op.substr(1);
+                std::string_view mode;
+                if (!rest.empty() && (rest[0] == '/' || rest[0] == '#' || rest[0] == '%')) {
+                    mode = rest.substr(0, 1);
+                    rest.remove_prefix(1);
+                }
+                size_t slash = 0;
+                while (slash < rest.size() && rest[slash] != '/') {
+                    slash += rest[slash] == '\\' ? 2 : 1;
+                }
+                slash = std::min(slash, rest.size());
+                std::string replacement_storage;
+                auto pattern = expand_operand(rest.substr(0, slash), true, storage);
+                auto replacement = slash < rest.size() ?
+                                   expand_operand(rest.substr(slash + 1), false, replacement_storage) : "";
+                append_replaced(out, text, pattern, replacement, mode);
+                return;
+            }
+            case ':': {
+                auto range = op.substr(1);
+                auto colon_pos = range.find(':');
+                auto size = static_cast<int64_t>(text.size());
+                auto offset = evaluate_arithmetic(expand_vars(range.substr(0, colon_pos)));
+                if (offset < 0) {
+                    offset = std::max<int64_t>(size + offset, 0);
+                }
+                offset = std::min(offset, size);
+                auto end = size;
+                if (colon_pos != std::string_view::npos) {
+                    auto length = evaluate_arithmetic(expand_vars(range.substr(colon_pos + 1)));
+                    end = length < 0 ? size + length : std::min(size, offset + length);
+                    if (end < offset) {
+                        throw msh_exception(std::string{range.substr(colon_pos + 1)} + ": substring expression < 0");
+                    }
+                }
+                out += text.substr(static_cast<size_t>(offset), static_cast<size_t>(end - offset));
+                return;
+            }
+            default:
+                throw bad_substitution();
+        }
+    }
+
+    /**
+     * @brief Append the expansion of the parameter reference starting with `$` at @p pos to @p out.
+     *
+     * @return The position following the reference. If there is no valid reference at @p pos,
+     * a literal `$` is appended.
+     */
+    size_t expand_parameter(std::string &out, std::string_view value, size_t pos) {
+        if (pos + 1 < value.size() && value[pos + 1] == '{') {
+            auto end = find_parameter_end(value, pos);
+            if (end == std::string_view::npos) {
+                out += '$';
+                return pos + 1;
+            }
+            expand_braced(out, value.substr(pos + 2, end - pos - 3));
+            return end;
+        }
+        if (pos + 1 < value.size() && append_special(out, value[pos + 1])) {
+            return pos + 2;
+        }
+
+        size_t end = pos + 1;
+        while (end < value.size() && (isalnum(static_cast<unsigned char>(value[end])) || value[end] == '_')) {
+            ++end;
+        }
+        auto var_name = value.substr(pos + 1, end - pos - 1);
+        if (var_name.empty()) {
+            out += '$';
+            return pos + 1;
+        }
+        if (auto var = get_variable(var_name); var != nullptr) {
+            out += var->value;
+        }
+        return end;
+    }
+}
+
+/**
+ * @brief Get the delimiters of word splitting.
+ *
+ * The delimiters are the bytes of the IFS variable, if set, otherwise <space>, <tab> and <newline>.
+ */
+const byte_set &get_ifs() {
+    if (!ifs_delimiters) {
+        const auto ifs = get_variable("IFS");
+        ifs_delimiters.emplace(ifs != nullptr ? ifs->value : " \t\n");
+    }
+    return *ifs_delimiters;
+}
+
+/**
+ * @brief Invalidate the delimiters of word splitting. Called whenever IFS is set.
+ *
+ * @see set_variable
+ */
+void ifs_changed() {
+    ifs_delimiters.reset();
+}
+
+/**
+ * @brief Expand variables within a string.
+ *
+ * Replaces every `$NAME` with the value of the corresponding variable. If no variable with
+ * the given name is found, expansion result to an empty string. `\$` produces a literal dollar sign.
+ * Special parameters, e.g. `$1` or `$?`, are expanded as well, see append_special().
+ *
+ * `${...}` supports `${name}`, `${#name}`, defaults and alternate values (`-`, `=`, `+`, `?`,
+ * with or without a colon), prefix and suffix removal (`#`, `##`, `%`, `%%`), substrings
+ * (`:offset:length`) and replacement (`/`, `//`, `/#`, `/%`). The value of the parameter is
+ * never copied, only the result is appended to the output.
+ *
+ * @param value The string to expand variables within.
+ * @return The expanded string.
+ *
+ * @throws msh_exception if a `${...}` expansion is invalid.
+ *
+ * @see get_variable
+ */
+std::string expand_vars(std::string_view value) {
+    std::string new_value;
+    new_value.reserve(value.size());
+
+    for (size_t i = 0; i < value.size(); i++) {
+        if (value[i] == '\\' && i + 1 < value.size() && value[i + 1] == '$') {
+            new_value += value[++i];
+            continue;
+        }
+        if (value[i] != '$') {
+            new_value += value[i];
+            continue;
+        }
+        i = expand_parameter(new_value, value, i) - 1;
+    }
+    return new_value;
+}
+
+/**
+ * @brief Find the end of the parameter expansion `${...}` starting at @p pos.
+ *
+ * Nested expansions, quotes and backslash escapes within the braces are skipped.
+ *
+ * @param value The string containing the expansion.
+ * @param pos The position of the `$`.
+ * @return The position following the closing brace, std::string_view::npos if it is not closed.
+ */
+size_t find_parameter_end(std::string_view value, size_t pos) {
+    int depth = 0;
+    for (auto i = pos + 1; i < value.size(); ++i) {
+        switch (value[i]) {
+            case '{':
+                depth += value[i - 1] == '$';
+                break;
+            case '}':
+                if (--depth == 0) {
+                    return i + 1;
+                }
+                break;
+            case '\\':
+                ++i;
+                break;
+            case '\'':
+                i = std::min(value.find('\'', i + 1), value.size());
+                break;
+            case '"':
+                for (++i; i < value.size() && value[i] != '"'; ++i) {
+                    i += value[i] == '\\';
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return std::string_view::npos;
+}
+
+namespace {
+    /**
+     * @brief Check whether @p value may be changed by filename expansion.
+     *
+     * Values without pattern characters are matched literally by msh_glob() and the token is
+     * left unchanged either way, so such tokens are not passed to it at all.
+     */
+    bool has_glob_chars(std::string_view value) {
+        return value.starts_with('~') || value.find_first_of("*?[\\") != std::string_view::npos;
+    }
+
+    /**
+     * @brief Escape the pattern characters of a quoted word of a CONDITIONAL_COMMAND, so they are matched literally.
+     */
+    std::string escape_pattern(std::string_view value) {
+        std::string res;
+        res.reserve(value.size() + 8);
+        for (auto c: value) {
+            if (c == '*' || c == '?' || c == '[' || c == '\\') {
+                res += '\\';
+            }
+            res += c;
+        }
+        return res;
+    }
+
+    /**
+     * @brief Check whether word splitting may change @p value.
+     */
+    bool has_ifs_chars(std::string_view value) {
+        return find_first_of(value, 0, get_ifs()) != value.size();
+    }
+
+    /**
+     * @brief Output of a single expansion pass.
+     *
+     * Tokens are appended to @c out already squashed: a WORD_LIKE token following another
+     * WORD_LIKE token is merged into it. EMPTY tokens are only kept where they separate words.
+     */
+    struct expansion {
+        tokens_t out;
+
+        void separate() {
+            if (!out.empty() && out.back().get_flag(WORD_LIKE)) {
+                out.emplace_back(TokenType::EMPTY);
+            }
+        }
+
+        void emit(Token token) {
+            if (token.type == TokenType::EMPTY) {
+                separate();
+                return;
+            }
+            if (!token.get_flag(WORD_LIKE) || out.empty() || !out.back().get_flag(WORD_LIKE)) {
+                out.push_back(std::move(token));
+                return;
+            }
+
+            auto &last = out.back();
+            auto lhs = last.value(), rhs = token.value();
+            if (lhs.data() + lhs.size() == rhs.data() && last.get_arena() == token.get_arena()) {
+                // Adjacent views of the same arena, e.g. a"b", are merged without copying
+                auto offset = static_cast<size_t>(lhs.data() - token.get_arena().get());
+                token.set_view(token.get_arena(), offset, lhs.size() + rhs.size());
+            } else {
+                std::string merged;
+                merged.reserve(lhs.size() + rhs.size());
+                merged.append(lhs).append(rhs);
+                token.set_value(std::move(merged));
+            }
+            last = std::move(token);
+        }
+
+        void emit_globbed(Token token) {
+            if (!token.get_flag(GLOB_EXPAND) || !has_glob_chars(token.value())) {
+                emit(std::move(token));
+                return;
+            }
+
+            auto matches = msh_glob(token.value());
+            if (matches.empty()) {
+                emit(std::move(token));
+                return;
+            }
+
+            std::string paths;
+            for (auto const &match: matches) {
+                paths += match;
+            }
+            auto arena = make_arena(std::move(paths));
+
+            size_t offset = 0;
+            for (size_t j = 0; j < matches.size(); j++) {
+                if (j != 0) {
+                    separate();
+                }
+                emit(Token(TokenType::WORD, arena, offset, matches[j].size()));
+                offset += matches[j].size();
+            }
+        }
+
+        /**
+         * @brief Perform word splitting on @p input, emitting the words as WORD tokens.
+         *
+         * The words are views into @p arena, no words are copied. Runs of delimiters, including
+         * leading and trailing ones, separate words, see get_ifs().
+         *
+         * @param arena The arena @p input points into.
+         * @param input The input string to be split.
+         */
+        void emit_split(const arena_t &arena, std::string_view input) {
+            auto const &delimiters = get_ifs();
+            auto offset = static_cast<size_t>(input.data() - arena.get());
+
+            for (size_t pos = 0; pos < input.size();) {
+                auto start = find_first_not_of(input, pos, delimiters);
+                if (start != pos) {
+                    separate();
+                }
+                if (start == input.size()) {
+                    break;
+                }
+                pos = find_first_of(input, start, delimiters);
+                emit_globbed(Token(TokenType::WORD, arena, offset + start, pos - start));
+            }
+        }
+
+        /**
+         * @brief Emit the positional parameters as separate words, e.g. for `"$@"`.
+         *
+         * @param prefix Prepended to the first word.
+         * @param suffix Appended to the last word.
+         */
+        void emit_parameters(std::string prefix, std::string_view suffix) {
+            auto args = positional_parameters();
+            if (args.empty() && prefix.empty() && suffix.empty()) {
+                return;
+            }
+            for (size_t i = 0; i < std::max<size_t>(args.size(), 1); ++i) {
+                std::string word = i == 0 ? std::move(prefix) : std::string{};
+                if (i < args.size()) {
+                    word += args[i];
+                }
+                if (i + 1 >= args.size()) {
+                    word += suffix;
+                }
+                if (i != 0) {
+                    separate();
+                }
+                Token token(TokenType::DQSTRING);
+                token.set_value(std::move(word));
+                emit(std::move(token));
+            }
+        }
+
+        /**
+         * @brief Perform word splitting on @p input, taking ownership of it.
+         */
+        void emit_split(std::string input) {
+            auto size = input.size();
+            auto arena = make_arena(std::move(input));
+            emit_split(arena, {arena.get(), size});
+        }
+    };
+}
+
+/**
+ * @brief Expand the tokens of a simple command.
+ *
+ * Performs all expansions in a single pass, writing the result into a new vector:
+ * <li> Variables are expanded in VAR_EXPAND tokens and the result is split into words,
+ * unless the token is flagged as NO_WORD_SPLIT. `$@` in such a token expands to a separate
+ * word for every positional parameter. </li>
+ * <li> COM_SUB tokens are replaced with the output of the command, split into words in the
+ * same way. All substitutions of the command are started before the expansion, see
+ * substitution_queue. </li>
+ * <li> ARITH tokens are replaced with the value of the expression after expanding variables
+ * within it, see evaluate_arithmetic(). </li>
+ * <li> PROC_SUB_IN and PROC_SUB_OUT tokens are replaced with the path of a pipe connected to
+ * the command, see start_process_substitution(). </li>
+ * <li> Variables are expanded in VAR_DECL tokens, which are joined with the WORD_LIKE token
+ * directly following them. The variables are set after the whole command is expanded. </li>
+ * <li> GLOB_EXPAND tokens are replaced with the matching file names, if any, see msh_glob(). </li>
+ * <li> Adjacent WORD_LIKE tokens are squashed into one. </li>
+ *
+ * The token following an assignment word is not eligible for word splitting if the assignment
+ * is a VAR_DECL or an argument of a builtin flagged as DECLARATION_COMMAND, e.g. `mexport`.
+ *
+ * The word of a here-string is neither split nor globbed.
+ *
+ * Arguments of a builtin flagged as CONDITIONAL_COMMAND, i.e. `[[`, are neither split nor
+ * globbed. Pattern characters of their quoted parts are escaped with a backslash instead,
+ * so the builtin can tell them from the unquoted ones.
+ *
+ * Tokens without anything to expand are passed through untouched, so they keep pointing
+ * into the arena of the lexer.
+ *
+ * @param tokens Tokens of a simple command. They are not modified, so the command can be
+ * expanded again.
+ * @return The expanded tokens.
+ *
+ * @throws msh_exception if an error occurs during expansion.
+ *
+ * @see Token
+ * @see token_flags
+ * @see set_variable
+ */
+tokens_t expand_tokens(const tokens_t &tokens) {
+    using enum TokenType;
+
+    expansion expanded;
+    expanded.out.reserve(tokens.size());
+    std::vector<std::string> assignments;
+    std::optional<std::string> declaration;
+    builtin current_command{};
+    bool no_split_next = false;
+    bool conditional = false;
+    bool here_string = false;
+    substitution_queue substitutions(tokens);
+    glob_cache_new_command();
+
+    for (auto const &token: tokens) {
+        if (token.type == COMMAND) {
+            if (auto builtin = builtin_commands.find(token.value()); builtin != builtin_commands.end()) {
+                current_command = builtin->second;
+                conditional = current_command.get_flag(CONDITIONAL_COMMAND);
+            }
+        }
+
+        if (token.type == HERESTRING) {
+            here_string = true;
+        } else if (token.type == EMPTY && !expanded.out.empty() && expanded.out.back().get_flag(WORD_LIKE)) {
+            here_string = false;
+        }
+
+        bool split = !token.get_flag(NO_WORD_SPLIT) && !no_split_next && !conditional && !here_string;
+        no_split_next = false;
+
+        if (token.get_flag(ASSIGNMENT_WORD)) {
+            no_split_next = token.type == VAR_DECL || current_command.get_flag(DECLARATION_COMMAND);
+        }
+
+        if (token.type == VAR_DECL) {
+            if (declaration) {
+                assignments.push_back(std::move(*declaration));
+            }
+            declaration = expand_vars(token.value());
+            expanded.separate();
+            continue;
+        }
+
+        Token piece = token;
+        if (token.type == COM_SUB) {
+            auto [arena, result] = substitutions.next();
+            if (split) {
+                expanded.emit_split(arena, result);
+                continue;
+            }
+            piece.set_view(arena, static_cast<size_t>(result.data() - arena.get()), result.size());
+        } else if (token.type == PROC_SUB_IN || token.type == PROC_SUB_OUT) {
+            piece.set_value(start_process_substitution(token.value(), token.type == PROC_SUB_OUT));
+        } else if (token.type == ARITH) {
+            auto result = std::to_string(evaluate_arithmetic(expand_vars(token.value())));
+            if (split) {
+                expanded.emit_split(std::move(result));
+                continue;
+            }
+            piece.set_value(std::move(result));
+        } else if (token.get_flag(VAR_EXPAND)) {
+            auto value = token.value();
+            if (auto at = find_all_parameters(value); at != std::string_view::npos && !split && !declaration) {
+                expanded.emit_parameters(expand_vars(value.substr(0, at)), expand_vars(value.substr(at + 2)));
+                continue;
+            }
+            bool has_vars = value.find('$') != std::string_view::npos;
+            if (split && (has_vars || has_ifs_chars(value))) {
+                if (has_vars) {
+                    expanded.emit_split(expand_vars(value));
+                } else {
+                    expanded.emit_split(token.get_arena(), value);
+                }
+                continue;
+            }
+            if (split) {
+                piece.set_type(WORD);
+            } else if (has_vars) {
+                piece.set_value(expand_vars(value));
+            }
+        }
+
+        if (declaration) {
+            if (piece.get_flag(WORD_LIKE)) {
+                assignments.push_back(*declaration + std::string{piece.value()});
+                declaration.reset();
+                continue;
+            }
+            assignments.push_back(std::move(*declaration));
+            declaration.reset();
+        }
+        if (conditional) {
+            if (token.get_flag(NO_WORD_SPLIT) && has_glob_chars(piece.value())) {
+                piece.set_value(escape_pattern(piece.value()));
+            }
+            expanded.emit(std::move(piece));
+            continue;
+        }
+        if (here_string) {
+            expanded.emit(std::move(piece));
+            continue;
+        }
+        expanded.emit_globbed(std::move(piece));
+    }
+    if (declaration) {
+        assignments.push_back(std::move(*declaration));
+    }
+
+    for (auto const &assignment: assignments) {
+        auto pos = assignment.find('=');
+        set_variable(std::string_view{assignment}.substr(0, pos), assignment.substr(pos + 1));
+    }
+    return std::move(expanded.out);
+}
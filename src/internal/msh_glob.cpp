@@ -0,0 +1,372 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Filename expansion.
+ *
+ * Patterns are matched against directory listings kept in a cache, so a directory is read
+ * at most once per command no matter how many patterns refer to it. Listings are kept
+ * across commands, keyed by the device and inode of the directory, and are reused as long
+ * as the modification time of the directory is unchanged.
+ *
+ * Besides the patterns supported by glob(3), a `**` component matches any number of
+ * directories. The directory tree is walked level by level, reading the directories of
+ * a level in parallel.
+ */
+
+#include "internal/msh_glob.h"
+#include "internal/msh_internal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    struct dir_entry {
+        std::string name;
+        unsigned char type; ///< d_type, may be DT_UNKNOWN
+    };
+
+    struct dir_listing {
+        timespec mtime{};
+        bool racy = false; ///< Modified too recently to rely on the modification time
+        std::vector<dir_entry> entries;
+    };
+
+    using listing_ptr = std::shared_ptr<const dir_listing>;
+
+    /**
+     * @brief Listings of all directories read so far, keyed by device and inode.
+     */
+    std::map<std::pair<dev_t, ino_t>, listing_ptr> listings;
+
+    /**
+     * @brief Listings used by the current command, keyed by path. Nothing is validated on a hit.
+     */
+    std::unordered_map<std::string, listing_ptr> command_listings;
+
+    /**
+     * @brief Guards both caches during a parallel walk.
+     */
+    std::mutex cache_mutex;
+
+    /**
+     * @brief Read the directory @p path.
+     *
+     * @return The listing, or nullptr if the directory can't be read.
+     */
+    listing_ptr read_directory(const char *path, struct stat &st) {
+        int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1) {
+            return nullptr;
+        }
+        DIR *dir = fdopendir(fd);
+        if (dir == nullptr || fstat(fd, &st) == -1) {
+            dir != nullptr ? closedir(dir) : close(fd);
+            return nullptr;
+        }
+
+        auto listing = std::make_shared<dir_listing>();
+        listing->mtime = st.st_mtim;
+        while (auto entry = readdir(dir)) {
+            listing->entries.push_back({entry->d_name, entry->d_type});
+        }
+        closedir(dir);
+
+        // A change within the granularity of the timestamp may leave the modification time unchanged
+        timespec now{};
+        clock_gettime(CLOCK_REALTIME, &now);
+        listing->racy = listing->mtime.tv_sec >= now.tv_sec - 1;
+        return listing;
+    }
+
+    /**
+     * @brief Get the listing of the directory @p prefix, reading it only if the cached one is outdated.
+     *
+     * Thread-safe.
+     *
+     * @param prefix The directory, empty for the current one.
+     * @return The listing, or nullptr if the directory can't be read.
+     */
+    listing_ptr list_directory(const std::string &prefix) {
+        {
+            std::lock_guard lock(cache_mutex);
+            if (auto it = command_listings.find(prefix); it != command_listings.end()) {
+                return it->second;
+            }
+        }
+
+        const char *path = prefix.empty() ? "." : prefix.c_str();
+        struct stat st{};
+        listing_ptr listing;
+        if (stat(path, &st) == 0) {
+            std::lock_guard lock(cache_mutex);
+            auto it = listings.find({st.st_dev, st.st_ino});
+            if (it != listings.end() && !it->second->racy &&
+                it->second->mtime.tv_sec == st.st_mtim.tv_sec && it->second->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                listing = it->second;
+            }
+        }
+        if (listing == nullptr) {
+            listing = read_directory(path, st);
+        }
+
+        std::lock_guard lock(cache_mutex);
+        if (listing != nullptr) {
+            if (listings.size() >= MSH_GLOB_CACHE_SIZE) {
+                listings.clear();
+            }
+            listings[{st.st_dev, st.st_ino}] = listing;
+        }
+        command_listings[prefix] = listing;
+        return listing;
+    }
+
+    /**
+     * @brief Check whether the entry @p entry of the directory @p prefix is a directory.
+     *
+     * @param follow Whether a symbolic link to a directory counts as a directory.
+     */
+    bool is_directory(const std::string &prefix, const dir_entry &entry, bool follow) {
+        if (entry.type == DT_DIR) {
+            return true;
+        }
+        if (entry.type != DT_UNKNOWN && (entry.type != DT_LNK || !follow)) {
+            return false;
+        }
+        struct stat st{};
+        auto path = prefix + entry.name;
+        int res = follow ? stat(path.c_str(), &st) : lstat(path.c_str(), &st);
+        return res == 0 && S_ISDIR(st.st_mode);
+    }
+
+    bool is_magic(std::string_view component) {
+        for (size_t i = 0; i < component.size(); ++i) {
+            if (component[i] == '\\') {
+                ++i;
+            } else if (component[i] == '*' || component[i] == '?' || component[i] == '[') {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string unescape(std::string_view component) {
+        std::string res;
+        res.reserve(component.size());
+        for (size_t i = 0; i < component.size(); ++i) {
+            if (component[i] == '\\' && i + 1 < component.size()) {
+                ++i;
+            }
+            res += component[i];
+        }
+        return res;
+    }
+
+    /**
+     * @brief Get the listings of all @p prefixes, reading them in parallel if there are many.
+     */
+    std::vector<listing_ptr> list_directories(const std::vector<std::string> &prefixes) {
+        std::vector<listing_ptr> res(prefixes.size());
+        size_t threads = std::min<size_t>({MSH_GLOB_THREADS, std::thread::hardware_concurrency(), prefixes.size() / 4});
+        if (threads < 2) {
+            for (size_t i = 0; i < prefixes.size(); ++i) {
+                res[i] = list_directory(prefixes[i]);
+            }
+            return res;
+        }
+
+        std::atomic<size_t> next = 0;
+        auto worker = [&]() {
+            for (size_t i; (i = next.fetch_add(1)) < prefixes.size();) {
+                res[i] = list_directory(prefixes[i]);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < threads; ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread: pool) {
+            thread.join();
+        }
+        return res;
+    }
+
+    /**
+     * @brief Walk the directory tree under @p prefix, skipping hidden files and not following symbolic links.
+     *
+     * @param prefix The root of the walk.
+     * @param files Whether to collect files and directories below @p prefix, or @p prefix and the
+     * directories below it, with a trailing slash.
+     * @param out The vector to append the paths to.
+     */
+    void walk(const std::string &prefix, bool files, std::vector<std::string> &out) {
+        std::vector<std::string> level{prefix};
+        while (!level.empty()) {
+            auto level_listings = list_directories(level);
+            std::vector<std::string> next_level;
+            for (size_t i = 0; i < level.size(); ++i) {
+                if (level_listings[i] == nullptr) {
+                    continue;
+                }
+                if (!files) {
+                    out.push_back(level[i]);
+                }
+                for (auto const &entry: level_listings[i]->entries) {
+                    if (entry.name.starts_with('.')) {
+                        continue;
+                    }
+                    if (is_directory(level[i], entry, false)) {
+                        next_level.push_back(level[i] + entry.name + '/');
+                        if (files) {
+                            out.push_back(level[i] + entry.name);
+                        }
+                    } else if (files) {
+                        out.push_back(level[i] + entry.name);
+                    }
+                }
+            }
+            level = std::move(next_level);
+        }
+    }
+
+    /**
+     * @brief Get the home directory for a leading `~` or `~user`.
+     *
+     * @return The home directory, or an empty string if unknown.
+     */
+    std::string home_directory(std::string_view user) {
+        if (user.empty()) {
+            if (auto home = get_variable("HOME"); home != nullptr) {
+                return home->value;
+            }
+            auto pw = getpwuid(getuid());
+            return pw != nullptr ? pw->pw_dir : "";
+        }
+        auto pw = getpwnam(std::string{user}.c_str());
+        return pw != nullptr ? pw->pw_dir : "";
+    }
+}
+
+/**
+ * @brief Find the paths matching @p pattern.
+ *
+ * Supports the same patterns as glob(3) with GLOB_TILDE: `*`, `?`, bracket expressions,
+ * backslash escapes and a leading `~` or `~user`. Hidden files are matched only by a
+ * leading dot in the pattern. A pattern ending with a slash matches directories only.
+ *
+ * A `**` component matches any number of non-hidden directories, symbolic links are
+ * not followed. At the end of the pattern it matches all non-hidden files below.
+ *
+ * @param pattern The pattern to match.
+ * @return The matching paths in sorted order, empty if nothing matches.
+ *
+ * @see glob_cache_new_command
+ */
+std::vector<std::string> msh_glob(std::string_view pattern) {
+    std::string base;
+    if (pattern.starts_with('~')) {
+        auto slash = pattern.find('/');
+        auto home = home_directory(pattern.substr(1, slash == std::string_view::npos ? slash : slash - 1));
+        if (!home.empty()) {
+            base = home;
+            pattern = slash == std::string_view::npos ? "" : pattern.substr(slash);
+        }
+    }
+    while (pattern.starts_with('/')) {
+        if (!base.ends_with('/')) {
+            base += '/';
+        }
+        pattern.remove_prefix(1);
+    }
+
+    std::vector<std::string_view> components;
+    bool only_directories = pattern.ends_with('/');
+    for (size_t start = 0; start < pattern.size();) {
+        auto end = std::min(pattern.find('/', start), pattern.size());
+        if (end != start) {
+            components.push_back(pattern.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    if (components.empty()) {
+        struct stat st{};
+        return !base.empty() && lstat(base.c_str(), &st) == 0 ? std::vector{base} : std::vector<std::string>{};
+    }
+
+    std::vector<std::string> prefixes{base};
+    for (size_t i = 0; i < components.size() && !prefixes.empty(); ++i) {
+        auto component = components[i];
+        bool last = i + 1 == components.size() && !only_directories;
+        std::vector<std::string> matches;
+
+        if (component == "**") {
+            for (auto const &prefix: prefixes) {
+                walk(prefix, last, matches);
+            }
+        } else if (!is_magic(component)) {
+            auto name = unescape(component);
+            for (auto const &prefix: prefixes) {
+                auto path = prefix + name;
+                struct stat st{};
+                if (i + 1 < components.size()) {
+                    // Checked when the directory is listed
+                    matches.push_back(path + '/');
+                } else if (!last) {
+                    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+                        matches.push_back(path + '/');
+                    }
+                } else if (lstat(path.c_str(), &st) == 0) {
+                    matches.push_back(std::move(path));
+                }
+            }
+        } else {
+            std::string pattern_component{component};
+            auto prefix_listings = list_directories(prefixes);
+            for (size_t j = 0; j < prefixes.size(); ++j) {
+                if (prefix_listings[j] == nullptr) {
+                    continue;
+                }
+                for (auto const &entry: prefix_listings[j]->entries) {
+                    if (fnmatch(pattern_component.c_str(), entry.name.c_str(), FNM_PERIOD) != 0) {
+                        continue;
+                    }
+                    if (last) {
+                        matches.push_back(prefixes[j] + entry.name);
+                    } else if (is_directory(prefixes[j], entry, true)) {
+                        matches.push_back(prefixes[j] + entry.name + '/');
+                    }
+                }
+            }
+        }
+        prefixes = std::move(matches);
+    }
+
+    std::erase(prefixes, "");
+    std::sort(prefixes.begin(), prefixes.end());
+    prefixes.erase(std::unique(prefixes.begin(), prefixes.end()), prefixes.end());
+    return prefixes;
+}
+
+/**
+ * @brief Start a new command. The listings used by the previous one are validated before reuse.
+ */
+void glob_cache_new_command() {
+    command_listings.clear();
+}
@@ -0,0 +1,124 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Command hash table.
+ *
+ * Remembers where the external commands were found in PATH, so a command is searched for
+ * only once per session instead of on every execution.
+ */
+
+#include "internal/msh_hash.h"
+#include "internal/msh_internal.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * @brief The command hash table.
+ *
+ * Maps command names to their locations. Cleared whenever PATH changes.
+ *
+ * @see hash_lookup
+ */
+std::unordered_map<std::string, hashed_command, variable_hash, std::equal_to<>> command_hash;
+
+/**
+ * @brief Lookup statistics of the command hash table, reported by `mhash -s`.
+ */
+hash_stats command_hash_stats;
+
+/**
+ * @brief Check whether @p path is an executable regular file.
+ */
+static bool is_executable(const std::string &path) {
+    struct stat st{};
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(path.c_str(), X_OK) == 0;
+}
+
+/**
+ * @brief Search PATH for the command with the given name.
+ *
+ * Empty PATH entries stand for the current directory.
+ *
+ * @param name Name of the command.
+ * @return Path to the command, or an empty string if it is not found.
+ */
+static std::string search_path(std::string_view name) {
+    auto path_var = get_variable("PATH");
+    if (path_var == nullptr || name.empty()) {
+        return {};
+    }
+
+    std::string_view path = path_var->value;
+    std::string candidate;
+    while (true) {
+        auto end = path.find(':');
+        auto dir = path.substr(0, end);
+
+        candidate.assign(dir.empty() ? "." : dir);
+        candidate.append("/").append(name);
+        if (is_executable(candidate)) {
+            return candidate;
+        }
+
+        if (end == std::string_view::npos) {
+            return {};
+        }
+        path.remove_prefix(end + 1);
+    }
+}
+
+/**
+ * @brief Search PATH for the command and store the result in the hash table.
+ *
+ * The result is stored even if the command is not found. Not counted in the lookup
+ * statistics, explicit `mhash name` calls would skew them.
+ *
+ * @param name Name of the command.
+ * @return Pointer to the path of the command, @c nullptr if it is not found.
+ */
+const std::string *hash_add(std::string_view name) {
+    auto it = command_hash.find(name);
+    if (it == command_hash.end()) {
+        it = command_hash.emplace(std::string{name}, hashed_command{}).first;
+    }
+    it->second.path = search_path(name);
+    it->second.hits = 0;
+    return it->second.path.empty() ? nullptr : &it->second.path;
+}
+
+/**
+ * @brief Find the command with the given name in PATH.
+ *
+ * The location is taken from the hash table if present. Cached locations that are no longer
+ * executable are searched for again.
+ *
+ * @param name Name of the command, must not contain a slash.
+ * @return Pointer to the path of the command, @c nullptr if it is not found.
+ */
+const std::string *hash_lookup(std::string_view name) {
+    auto it = command_hash.find(name);
+    if (it == command_hash.end() ||
+        (!it->second.path.empty() && access(it->second.path.c_str(), X_OK) != 0)) {
+        ++command_hash_stats.misses;
+        return hash_add(name);
+    }
+
+    auto &entry = it->second;
+
+    ++command_hash_stats.hits;
+    ++entry.hits;
+    return entry.path.empty() ? nullptr : &entry.path;
+}
+
+/**
+ * @brief Forget all remembered command locations.
+ */
+void hash_clear() {
+    command_hash.clear();
+}
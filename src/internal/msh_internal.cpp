@@ -14,8 +14,13 @@
 #include "msh_history.h"
 #include "internal/msh_jobs.h"
 #include "internal/msh_internal.h"
+#include "internal/msh_hash.h"
+#include "internal/msh_expand.h"
+#include "internal/msh_output.h"
+#include "internal/msh_read.h"
 
 #include <cstdio>
+#include <vector>
 #include <readline/history.h>
 
 /**
@@ -25,7 +30,36 @@
  *
  * @see variable
  */
-std::vector<variable> variables;
+variable_table_t variables;
+
+/**
+ * @brief The internal function table.
+ *
+ * Maps function names to their parsed bodies.
+ *
+ * @see msh_call_function
+ */
+function_table_t functions;
+
+/**
+ * @brief The frame of the function being executed, @c nullptr outside of functions.
+ *
+ * @see call_frame
+ */
+call_frame *current_frame = nullptr;
+
+namespace {
+    /**
+     * @brief Environment block of the exported variables.
+     *
+     * Rebuilt by msh_environ() only after an exported variable has changed.
+     */
+    struct {
+        std::vector<std::string> strings;
+        std::vector<char *> envp;
+        bool dirty = true;
+    } environment;
+}
 
 /**
  * @brief The internal token flags table.
@@ -65,8 +99,13 @@ const std::map<TokenType, int> token_flags = {
         {TokenType::IN_AMP,    REDIRECT},
         {TokenType::AMP_OUT,   REDIRECT},
         {TokenType::AMP_APPEND,REDIRECT},
+        {TokenType::HEREDOC,   REDIRECT},
+        {TokenType::HERESTRING,REDIRECT},
         {TokenType::SEMICOLON, COMMAND_SEPARATOR},
         {TokenType::COM_SUB,   WORD_LIKE},
+        {TokenType::ARITH,     WORD_LIKE},
+        {TokenType::PROC_SUB_IN, WORD_LIKE | NO_WORD_SPLIT},
+        {TokenType::PROC_SUB_OUT,WORD_LIKE | NO_WORD_SPLIT},
 };
 
 /**
@@ -76,10 +115,8 @@ const std::map<TokenType, int> token_flags = {
  * @return Pointer to the variable, @c nullptr otherwise
  */
 variable *get_variable(std::string_view name) {
-    for (auto &var : variables) {
-        if (var.name == name) {
-            return &var;
-        }
+    if (auto it = variables.find(name); it != variables.end()) {
+        return &it->second;
     }
     return nullptr;
 }
@@ -87,53 +124,125 @@ variable *get_variable(std::string_view name) {
 /**
  * @brief Set the value of an internal variable with the given name.
  *
+ * The variable is created if it does not exist yet. If the variable is exported,
+ * the environment block is invalidated. Setting PATH clears the command hash table,
+ * setting IFS invalidates the delimiters of word splitting.
+ *
  * @param name Name of the variable.
  * @param value Value to set.
+ * @return Reference to the variable.
+ *
+ * @see msh_environ
+ * @see hash_clear
+ * @see ifs_changed
+ */
+variable &set_variable(std::string_view name, std::string value) {
+    auto it = variables.find(name);
+    if (it == variables.end()) {
+        it = variables.emplace(std::string{name}, variable{}).first;
+        it->second.name = it->first;
+    }
+
+    auto &var = it->second;
+    var.value = std::move(value);
+    environment.dirty |= var.exported;
+    if (name == "PATH") {
+        hash_clear();
+    } else if (name == "IFS") {
+        ifs_changed();
+    }
+    return var;
+}
+
+/**
+ * @brief Mark the variable as exported, so it is passed to the environment of executed commands.
+ *
+ * @param var The variable to export.
  */
-void set_variable(const std::string &name, const std::string &value) {
-    auto *var = get_variable(name);
-    if (var == nullptr) {
-        variables.emplace_back(name, value);
-    } else {
-        var->value = value;
+void export_variable(variable &var) {
+    if (!var.exported) {
+        var.exported = true;
+        environment.dirty = true;
     }
 }
 
+/**
+ * @brief Get the environment block of the shell.
+ *
+ * The block contains a `NAME=value` entry for every exported variable and is rebuilt only
+ * if an exported variable has changed since the last call. The global @c environ is pointed
+ * to the block as well, so the library functions relying on it (e.g. getenv(), execvpe())
+ * see the same environment.
+ *
+ * @return Null-terminated array of the environment strings, suitable for execve().
+ */
+char **msh_environ() {
+    if (environment.dirty) {
+        environment.strings.clear();
+        environment.envp.clear();
+        for (auto const &[name, var]: variables) {
+            if (var.exported) {
+                environment.strings.emplace_back(name + "=" + var.value);
+            }
+        }
+        for (auto &string: environment.strings) {
+            environment.envp.push_back(string.data());
+        }
+        environment.envp.push_back(nullptr);
+        environment.dirty = false;
+    }
+
+    extern char **environ;
+    environ = environment.envp.data();
+    return environ;
+}
+
+/**
+ * @brief The process that read the history, the only one to save it on exit. 0 if the
+ * history is not used, i.e. the shell is not interactive.
+ */
+static pid_t history_owner = 0;
+
 /**
  * @brief Initialize the shell.
  *
  * This function should be called before any other shell functions.
  *
- * Sets up necessary handlers, job control, and copies the current process
- * environment variables internally.
+ * Sets up necessary handlers, job control, the buffered output, and copies the current
+ * process environment variables internally. The history is read only by an interactive
+ * shell, a shell running a script or `-c` commands starts without it.
  *
  * Sets the @c SHELL and @c VERSION to default values specified in msh_internal.h
+ *
+ * @param interactive Whether commands are read from a terminal with readline.
  */
-void msh_init() {
+void msh_init(bool interactive) {
+    output_init();
     atexit(msh_exit);
-    read_history(MSH_HISTORY_PATH);
+    if (interactive) {
+        read_history(MSH_HISTORY_PATH);
+        history_owner = getpid();
+    }
 
     extern char** environ;
     for (char** env = environ; *env != nullptr; ++env) {
-        std::string env_string(*env);
+        std::string_view env_string(*env);
         size_t pos = env_string.find('=');
         if (pos != std::string::npos) {
-            std::string name = env_string.substr(0, pos);
-            std::string value = env_string.substr(pos + 1);
-            set_variable(name, value);
+            auto &var = set_variable(env_string.substr(0, pos), std::string{env_string.substr(pos + 1)});
+            var.exported = true;
         }
     }
 
-    set_variable("SHELL", SHELL);
-    setenv("SHELL", SHELL, 1);
+    export_variable(set_variable("SHELL", SHELL));
     set_variable("VERSION", VERSION);
 
     auto new_path = std::string(MSH_EXTERNAL_BIN_PATH) + ":";
-    if (auto path = getenv("PATH"); path != nullptr) {
-        new_path += path;
+    if (auto path = get_variable("PATH"); path != nullptr) {
+        new_path += path->value;
     }
-    setenv("PATH", new_path.c_str(), 1);
-    set_variable("PATH", new_path);
+    export_variable(set_variable("PATH", std::move(new_path)));
+    msh_environ();
 
     init_job_control();
     // TODO! Read some .mshrc file and execute it to support setup scripts.
@@ -143,7 +252,9 @@ void msh_init() {
 /**
  * @brief Perform necessary operations before exiting the shell.
  *
- * Saves the history to the file specified by MSH_HISTORY_PATH.
+ * Writes out the buffered output, saves the history to the file specified by MSH_HISTORY_PATH
+ * and gives back the input read ahead by `mread`, so it is left for the next reader.
+ * The history is saved only by the interactive shell itself, not by its forked subshells.
  *
  * @note MSH_HISTORY_PATH is set automatically by the build system.
  *
@@ -152,5 +263,9 @@ void msh_init() {
  * @see atexit
  */
 void msh_exit() {
-    write_history(MSH_HISTORY_PATH);
+    msh_out.flush();
+    read_buffers_release();
+    if (history_owner == getpid()) {
+        write_history(MSH_HISTORY_PATH);
+    }
 }
@@ -16,10 +16,10 @@
 #include "internal/msh_jobs.h"
 #include "internal/msh_builtin.h"
 #include "internal/msh_exec.h"
+#include "internal/msh_output.h"
 
 #include <algorithm>
 #include <sys/wait.h>
-#include <iostream>
 
 
 /**
@@ -77,18 +77,22 @@ void sigchld_handler(int) {
  * @param status The process status.
  * @return The process exit status.
  *
+ * @note SIGCHLD should be blocked since the process was launched, see sigchld_guard.
+ * Otherwise the SIGCHLD handler may reap the process first.
+ *
  * @note Call to this function leads to explicit removal of the process with matching PID
  * from the internal process table.
  *
- * @note If both `WIFEXITED` and `WIFSIGNALED` are false for the process, the
- * return value is undefined.
- *
  * @see remove_process()
  */
 int wait_for_process(pid_t pid, int *status) {
-    while (waitpid(pid, status, WUNTRACED | WCONTINUED) != -1) {}
-    if (errno != ECHILD) {
-        msh_error("failed to wait for process " + std::to_string(pid) + ": " + strerror(errno));
+    while (waitpid(pid, status, 0) == -1) {
+        if (errno != EINTR) {
+            msh_error("failed to wait for process " + std::to_string(pid) + ": " + strerror(errno));
+            *status = 0;
+            remove_process(pid);
+            return UNKNOWN_ERROR;
+        }
     }
 
     if (WIFEXITED(*status)) {
@@ -141,9 +145,10 @@ int no_background_processes() {
  * @brief Print all internal processes.
  */
 void print_processes() {
+    sigchld_guard guard;
     int n = 0;
     for (auto const& [pid, process]: processes) {
-        std::cout << "[" << ++n << "] " << process.get_status() << "\t" << process.command << std::endl;
+        msh_out << '[' << ++n << "] " << process.get_status() << '\t' << process.command << '\n';
     }
 }
 
@@ -166,7 +171,7 @@ void print_completed_processes() {
     int n = 0;
     for (auto const& [pid, process]: processes) {
         if (process.status == status::DONE && process.flags & ASYNC) {
-            std::cout << "[" << ++n << "] " << process.get_status() << "\t" << process.command << std::endl;
+            msh_out << '[' << ++n << "] " << process.get_status() << '\t' << process.command << '\n';
         }
     }
 }
@@ -183,6 +188,7 @@ void print_completed_processes() {
  * @see remove_completed_processes()
  */
 void update_jobs() {
+    sigchld_guard guard;
     print_completed_processes();
     remove_completed_processes();
 }
@@ -216,5 +222,19 @@ void remove_process(pid_t pid) {
  * @param status The new process status.
  */
 void set_process_status(pid_t pid, status_t status) {
-    processes[pid].status = status;
+    if (auto it = processes.find(pid); it != processes.end()) {
+        it->second.status = status;
+    }
+}
+
+/**
+ * @brief Unblock SIGCHLD blocked by sigchld_guard.
+ *
+ * Should be called in forked children, which must not inherit SIGCHLD blocked.
+ */
+void unblock_sigchld() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &set, nullptr);
 }
@@ -0,0 +1,136 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Buffered standard output of the shell.
+ *
+ * Builtins write to msh_out, and so does @c std::cout once output_init() is called, so both
+ * share a single buffer. Flushing @c std::cout, e.g. by @c std::endl, flushes the buffer too,
+ * as does writing to @c std::cerr, which is tied to @c std::cout.
+ */
+
+#include "internal/msh_output.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <streambuf>
+#include <utility>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * @brief The standard output of the shell.
+ */
+output_sink msh_out(STDOUT_FILENO);
+
+namespace {
+    /**
+     * @brief Stream buffer forwarding everything to msh_out, installed into @c std::cout.
+     */
+    class sink_buffer : public std::streambuf {
+    protected:
+        int_type overflow(int_type c) override {
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                msh_out << traits_type::to_char_type(c);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char *s, std::streamsize n) override {
+            msh_out.write({s, static_cast<size_t>(n)});
+            return n;
+        }
+
+        int sync() override {
+            msh_out.flush();
+            return 0;
+        }
+    };
+
+    sink_buffer cout_buffer;
+}
+
+output_sink::output_sink(int fd) : fd(fd), buffer(new char[MSH_OUTPUT_BUFFER_SIZE]) {}
+
+/**
+ * @brief Append @p data to the buffer.
+ *
+ * If @p data doesn't fit, it is written together with the buffer by a single writev().
+ */
+void output_sink::write(std::string_view data) {
+    if (captured != nullptr) {
+        captured->append(data);
+        return;
+    }
+    if (size + data.size() <= MSH_OUTPUT_BUFFER_SIZE) {
+        memcpy(buffer.get() + size, data.data(), data.size());
+        size += data.size();
+        return;
+    }
+
+    iovec iov[2] = {{buffer.get(), size}, {const_cast<char *>(data.data()), data.size()}};
+    iovec *pending = iov[0].iov_len != 0 ? iov : iov + 1;
+    int count = static_cast<int>(iov + 2 - pending);
+    while (count != 0) {
+        auto written = writev(fd, pending, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Nothing to do if the output is gone, e.g. closed
+            break;
+        }
+        for (; count != 0 && static_cast<size_t>(written) >= pending->iov_len; ++pending, --count) {
+            written -= static_cast<ssize_t>(pending->iov_len);
+        }
+        if (count != 0) {
+            pending->iov_base = static_cast<char *>(pending->iov_base) + written;
+            pending->iov_len -= written;
+        }
+    }
+    size = 0;
+}
+
+/**
+ * @brief Write out the buffered output.
+ */
+void output_sink::flush() {
+    if (size != 0) {
+        auto pending = size;
+        size = 0;
+        std::string_view data{buffer.get(), pending};
+        while (!data.empty()) {
+            auto written = ::write(fd, data.data(), data.size());
+            if (written == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            data.remove_prefix(written);
+        }
+    }
+}
+
+/**
+ * @brief Redirect the output into @p target instead of the file descriptor.
+ *
+ * @param target The string to append the output to, nullptr to stop capturing.
+ * @return The previous capture target.
+ */
+std::string *output_sink::capture(std::string *target) {
+    return std::exchange(captured, target);
+}
+
+/**
+ * @brief Make @c std::cout write to msh_out.
+ */
+void output_init() {
+    std::cout.rdbuf(&cout_buffer);
+}
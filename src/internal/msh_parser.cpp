@@ -12,41 +12,327 @@
 #include "internal/msh_parser.h"
 #include "internal/msh_utils.h"
 #include "internal/msh_builtin.h"
+#include "internal/msh_scan.h"
 
 #include <boost/algorithm/string.hpp>
+#include <cstring>
 #include <stack>
+#include <utility>
+
+/**
+ * @brief Bytes that end a run of literal characters outside of quotes.
+ */
+static const byte_set word_delimiters{"$\\&|><;\"'=#() \t\n"};
+
+/**
+ * @brief Bytes that end a run of literal characters inside double quotes.
+ */
+static const byte_set dqstring_delimiters{"\"\\$"};
+
+/**
+ * @brief Blanks separating the words of a command.
+ */
+static const byte_set blanks{" \t"};
+
+/**
+ * @brief Bytes that end the delimiter word of a here-document.
+ */
+static const byte_set heredoc_word_delimiters{"&|><;() \t\n"};
+
+/**
+ * @brief Find the parenthesis closing the one at @p pos, skipping quoted parts.
+ *
+ * @return The position of the closing parenthesis, or npos if there is none.
+ */
+static size_t find_closing_parenthesis(std::string_view input, size_t pos) {
+    int depth = 0;
+    char quote = '\0';
+    for (; pos < input.size(); ++pos) {
+        auto c = input[pos];
+        if (quote != '\0') {
+            quote = c == quote ? '\0' : quote;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '(') {
+            ++depth;
+        } else if (c == ')' && --depth == 0) {
+            return pos;
+        }
+    }
+    return std::string_view::npos;
+}
+
+/**
+ * @brief Turn the body of an unquoted here-document into tokens for expand_tokens().
+ *
+ * The body is treated like the inside of double quotes, except that a double quote is an
+ * ordinary character. The text and the parameters in it form DQSTRING tokens, command and
+ * arithmetic substitutions form COM_SUB and ARITH tokens, none of them is split into words.
+ * A backslash escapes only `$`, `\\` and a newline.
+ *
+ * @param body The body, unescaped in place.
+ * @return The tokens, at least one.
+ *
+ * @throws msh_exception If a substitution or a parameter expansion is not closed.
+ */
+static tokens_t heredoc_tokens(std::string body) {
+    using enum TokenType;
+
+    struct piece {
+        TokenType type;
+        size_t offset;
+        size_t length;
+    };
+    std::vector<piece> pieces;
+    size_t w = 0, start = 0;
+    auto end_text = [&]() {
+        if (w != start) {
+            pieces.push_back({DQSTRING, start, w - start});
+        }
+    };
+
+    for (size_t i = 0; i < body.size();) {
+        auto c = body[i];
+        auto next = i + 1 < body.size() ? body[i + 1] : '\0';
+        size_t end = i + 1;
+        if (c == '\\' && next == '\n') {
+            i += 2;
+            continue;
+        }
+        if (c == '\\' && next == '\\') {
+            ++i;
+        } else if (c == '\\' && next == '$') {
+            // Left for expand_vars()
+            end = i + 2;
+        } else if (c == '$' && next == '{') {
+            end = find_parameter_end(body, i);
+            if (end == std::string_view::npos) {
+                throw msh_exception("expected '}'", INTERNAL_ERROR);
+            }
+        } else if (c == '$' && next == '(') {
+            auto close = find_closing_parenthesis(body, i + 1);
+            if (close == std::string_view::npos) {
+                throw msh_exception("expected ')'", INTERNAL_ERROR);
+            }
+            end_text();
+            auto length = close - i - 2;
+            pieces.push_back({body[i + 2] == '(' ? ARITH : COM_SUB, w, length});
+            std::memmove(body.data() + w, body.data() + i + 2, length);
+            w += length;
+            start = w;
+            i = close + 1;
+            continue;
+        }
+        std::memmove(body.data() + w, body.data() + i, end - i);
+        w += end - i;
+        i = end;
+    }
+    end_text();
+
+    auto arena = make_arena(std::move(body));
+    tokens_t tokens;
+    for (auto [type, offset, length]: pieces) {
+        tokens.emplace_back(type, arena, offset, length).set_flag(NO_WORD_SPLIT);
+    }
+    if (tokens.empty()) {
+        tokens.emplace_back(SQSTRING, arena, 0, 0);
+    }
+    return tokens;
+}
+
+/**
+ * @brief Check whether @p word is a reserved word followed by a command, e.g. `then` in `then mecho`.
+ */
+static bool is_command_prefix(std::string_view word) {
+    return word == "if" || word == "then" || word == "else" || word == "elif" ||
+           word == "while" || word == "until" || word == "do" || word == "{";
+}
 
 /**
  * @brief Perform lexical analysis on the given input string, breaking it down into a vector of tokens.
  *
+ * The input is copied once into an arena and the tokens are views into it. Since the value of a
+ * token is never longer than the part of the input it was produced from (quotes and escapes are
+ * only ever removed), the unescaped values are written back into the arena in place and no
+ * per-token allocation is performed.
+ *
+ * Runs of literal characters in words and strings are found with find_first_of() and
+ * appended at once instead of going through the main loop byte by byte.
+ *
+ * A newline separates commands like `;`, unless it follows another separator or starts the
+ * input, so compound commands can span several lines. `#` starts a comment only at the
+ * beginning of a word. Between `[[` and `]]`, `<` and `>` are words compared by the command
+ * rather than redirections.
+ *
+ * The bodies of here-documents are read from the lines following the one with the `<<word`
+ * or `<<-word` redirection, up to a line equal to the delimiter `word` with its quotes removed.
+ * The body is inserted as the target of the HEREDOC token: a single SQSTRING token if any part
+ * of the delimiter is quoted, otherwise the tokens made by heredoc_tokens().
+ *
+ * The value of a COM_SUB, ARITH, PROC_SUB_IN or PROC_SUB_OUT token is the text between the
+ * parentheses of `$(cmd)`, `$((expr))`, `<(cmd)` or `>(cmd)` respectively.
+ *
  * @param input The input string to be analyzed.
  * @return A vector of Token objects.
  *
  * @throws msh_exception If the input is invalid.
+ * @throws msh_incomplete_input If a quote, a substitution or a here-document is not closed.
  *
  * @see parse_input()
- * @see process_tokens()
+ * @see expand_tokens()
+ * @see arena_t
  */
 tokens_t lexer(const std::string &input) {
     using enum TokenType;
 
     tokens_t tokens;
-    Token current_token, previous_token;
+    Token current_token;
+    int previous_flags = 0;
     bool command_expected = true;
+    bool skip_leading = true;
+    bool joined = false;
+    bool conditional = false; ///< Between `[[` and `]]`, where `<` and `>` compare strings
     char current_char, next_char, open_until = '\0';
     size_t i = 0, len = input.length();
     std::stack<char> substitutions;
 
+    // Here-documents whose bodies start on the next line
+    struct pending_heredoc {
+        size_t index; ///< Position of the HEREDOC token in tokens
+        std::string delimiter;
+        bool quoted = false; ///< The body is taken literally
+        bool strip_tabs = false; ///< Leading tabs are removed from the lines, `<<-`
+    };
+    std::vector<pending_heredoc> heredocs;
+
+    auto storage = std::make_shared<std::string>(input);
+    auto *out = storage->data();
+    arena_t arena(storage, storage->data());
+    size_t w = 0, token_start = 0;
+
+    auto append = [&](char c) {
+        out[w++] = c;
+    };
+    // Append input[from, to). The arena starts as a copy of the input, so nothing has to be
+    // copied as long as no characters were dropped before.
+    auto append_run = [&](size_t from, size_t to) {
+        if (w != from) {
+            std::memcpy(out + w, input.data() + from, to - from);
+        }
+        w += to - from;
+    };
+    auto finish = [&]() {
+        current_token.set_view(arena, token_start, w - token_start);
+    };
+    // The first token pushed is always the initial placeholder and is dropped. So is the
+    // placeholder following a substitution, unless it was turned into a token.
+    auto push = [&]() {
+        finish();
+        if (skip_leading) {
+            skip_leading = false;
+            return;
+        }
+        if (std::exchange(joined, false) && current_token.type == EMPTY) {
+            return;
+        }
+        if (conditional && current_token.type == WORD && current_token.value() == "]]") {
+            conditional = false;
+        }
+        tokens.push_back(std::move(current_token));
+    };
+    // A parameter expansion is a single unit, e.g. ${x:-a b}
+    auto parameter_end = [&](size_t pos) {
+        auto end = find_parameter_end(input, pos);
+        if (end == std::string_view::npos) {
+            throw msh_incomplete_input("expected '}'");
+        }
+        return end;
+    };
+    auto begin = [&](TokenType type, std::string_view literal = {}) {
+        push();
+        current_token = Token(type);
+        token_start = w;
+        for (auto c: literal) {
+            append(c);
+        }
+    };
+    // Read the delimiter word of a here-document starting at pos, return the position after it
+    auto heredoc_delimiter = [&](size_t pos, pending_heredoc &heredoc) {
+        pos = find_first_not_of(input, pos, blanks);
+        auto start = pos;
+        while (pos < len && !heredoc_word_delimiters.contains(input[pos])) {
+            auto c = input[pos];
+            if (c == '\'' || c == '"') {
+                auto end = input.find(c, pos + 1);
+                if (end == std::string::npos) {
+                    throw msh_incomplete_input("unclosed delimiter: " + std::string(1, c));
+                }
+                heredoc.delimiter.append(input, pos + 1, end - pos - 1);
+                heredoc.quoted = true;
+                pos = end + 1;
+            } else if (c == '\\' && pos + 1 < len) {
+                heredoc.delimiter += input[pos + 1];
+                heredoc.quoted = true;
+                pos += 2;
+            } else {
+                heredoc.delimiter += c;
+                ++pos;
+            }
+        }
+        if (pos == start) {
+            throw msh_exception("expected a here-document delimiter", INTERNAL_ERROR);
+        }
+        return pos;
+    };
+    // Read the bodies of the pending here-documents from the lines starting at pos, return
+    // the position after the last delimiter line
+    auto read_heredocs = [&](size_t pos) {
+        size_t inserted = 0;
+        for (auto &heredoc: heredocs) {
+            std::string body;
+            while (true) {
+                auto eol = std::min(input.find('\n', pos), len);
+                auto start = pos;
+                while (heredoc.strip_tabs && start < eol && input[start] == '\t') {
+                    ++start;
+                }
+                if (std::string_view{input}.substr(start, eol - start) == heredoc.delimiter) {
+                    pos = std::min(eol + 1, len);
+                    break;
+                }
+                if (eol == len) {
+                    throw msh_incomplete_input("expected '" + heredoc.delimiter + "'", heredoc.delimiter);
+                }
+                body.append(input, start, eol + 1 - start);
+                pos = eol + 1;
+            }
+
+            auto body_tokens = heredoc.quoted ? tokens_t{Token(SQSTRING, std::move(body))}
+                                              : heredoc_tokens(std::move(body));
+            auto at = tokens.begin() + static_cast<std::ptrdiff_t>(heredoc.index + inserted + 1);
+            tokens.insert(at, body_tokens.begin(), body_tokens.end());
+            inserted += body_tokens.size();
+        }
+        heredocs.clear();
+        return pos;
+    };
+
     while (i < len) {
         current_char = input[i];
         next_char = i + 1 < len ? input[i + 1] : '\0';
-        previous_token = current_token.type == EMPTY ? previous_token : current_token;
+        if (current_token.type != EMPTY) {
+            previous_flags = current_token.flags;
+        }
 
         if (!tokens.empty() && tokens.back().type == WORD && command_expected) {
             tokens.back().set_type(COMMAND);
-            command_expected = false;
+            command_expected = is_command_prefix(tokens.back().value());
+            conditional = tokens.back().value() == "[[";
         }
         command_expected |= current_token.get_flag(COMMAND_SEPARATOR);
+        if (current_token.get_flag(COMMAND_SEPARATOR)) {
+            conditional = false;
+        }
 
         if (current_char == open_until && substitutions.empty()) {
             open_until = '\0';
@@ -67,23 +353,22 @@ tokens_t lexer(const std::string &input) {
         }
 
         if (open_until == '\'') {
-            while (i < len && input[i] != '\'') {
-                current_token.value += input[i];
-                ++i;
-            }
+            auto end = std::min(input.find('\'', i), len);
+            append_run(i, end);
+            i = end;
             continue;
         }
 
-        if (current_char == '$' && next_char == '(') {
-            if (!substitutions.empty()) {
-                substitutions.push('\0');
-                current_token.value += current_char;
-                ++i;
-                continue;
-            }
+        // Process substitutions `<(cmd)` and `>(cmd)` are collected the same way as `$(cmd)`
+        bool is_process_substitution = (current_char == '<' || current_char == '>') && open_until == '\0';
+        if ((current_char == '$' || is_process_substitution) && next_char == '(' && substitutions.empty()) {
             substitutions.push('\0');
-            tokens.push_back(current_token);
-            current_token = Token(COM_SUB);
+            if (is_process_substitution) {
+                begin(current_char == '<' ? PROC_SUB_IN : PROC_SUB_OUT);
+            } else {
+                // The value of an arithmetic expansion keeps the inner parentheses: $((1+2)) is `(1+2)`
+                begin(i + 2 < len && input[i + 2] == '(' ? ARITH : COM_SUB);
+            }
             if (open_until == '"') {
                 current_token.set_flag(NO_WORD_SPLIT);
             }
@@ -96,30 +381,48 @@ tokens_t lexer(const std::string &input) {
                 auto &top = substitutions.top();
                 top = top == '\0' ? current_char : '\0';
             }
+            if (current_char == '(' && substitutions.top() == '\0') {
+                substitutions.push('\0');
+            }
             if (current_char == ')' && substitutions.top() == '\0') {
                 substitutions.pop();
                 if (substitutions.empty()) {
-                    tokens.push_back(current_token);
-                    current_token = Token(EMPTY);
+                    // A word directly following the substitution is joined with it, e.g. $(cmd)suffix
+                    begin(EMPTY);
+                    joined = true;
                     i++;
                     continue;
                 }
             }
-            current_token.value += current_char;
+            append(current_char);
             ++i;
             continue;
         }
 
         if (open_until == '"') {
             if (current_char == '\\' && next_char == '\\') {
-                current_token.value += current_char;
+                append(current_char);
                 ++i;
             } else if (current_char == '\\' && next_char == '"') {
-                current_token.value += next_char;
+                append(next_char);
                 ++i;
             } else {
-                current_token.value += current_char;
+                auto end = current_char == '$' && next_char == '{' ? parameter_end(i)
+                                                                   : find_first_of(input, i + 1, dqstring_delimiters);
+                append_run(i, end);
+                i = end - 1;
+            }
+            ++i;
+            continue;
+        }
+
+        if (conditional && (current_char == '<' || current_char == '>')) {
+            // A separate word, e.g. `[[ a<b ]]` is `[[ a < b ]]`
+            if (current_token.type != EMPTY) {
+                begin(EMPTY);
             }
+            begin(WORD, std::string_view{&current_char, 1});
+            begin(EMPTY);
             ++i;
             continue;
         }
@@ -127,46 +430,41 @@ tokens_t lexer(const std::string &input) {
         switch (current_char) {
             case '\\':
                 if (current_token.type != WORD) {
-                    tokens.push_back(current_token);
-                    current_token = Token(WORD);
+                    begin(WORD);
                 }
                 if (next_char == '$') {
-                    current_token.value += current_char;
+                    append(current_char);
                 } else {
-                    current_token.value += next_char;
+                    append(next_char);
                     ++i;
                 }
                 break;
             case '&':
-                tokens.push_back(current_token);
-
                 switch (next_char) {
                     case '&':
-                        current_token = Token(AND, "&&");
+                        begin(AND, "&&");
                         ++i;
                         break;
                     case '>':
-                        current_token = Token(AMP_OUT, "&>");
+                        begin(AMP_OUT, "&>");
                         ++i;
                         break;
                     default:
-                        current_token = Token(AMP, "&");
-
+                        begin(AMP, "&");
                 }
                 break;
             case '|':
-                tokens.push_back(current_token);
                 switch (next_char) {
                     case '|':
-                        current_token = Token(OR, "||");
+                        begin(OR, "||");
                         ++i;
                         break;
                     case '&':
-                        current_token = Token(PIPE_AMP, "|&");
+                        begin(PIPE_AMP, "|&");
                         ++i;
                         break;
                     default:
-                        current_token = Token(PIPE, "|");
+                        begin(PIPE, "|");
                 }
                 break;
             case '>':
@@ -175,41 +473,47 @@ tokens_t lexer(const std::string &input) {
                     break;
                 }
 
-                tokens.push_back(current_token);
                 switch (next_char) {
                     case '&':
-                        current_token = Token(OUT_AMP, ">&");
+                        begin(OUT_AMP, ">&");
                         ++i;
                         break;
                     case '>':
-                        current_token = Token(OUT_APPEND, ">>");
+                        begin(OUT_APPEND, ">>");
                         ++i;
                         break;
                     default:
-                        current_token = Token(OUT, ">");
+                        begin(OUT, ">");
                 }
                 break;
             case '<':
-                tokens.push_back(current_token);
                 if (next_char == '&') {
-                    current_token = Token(IN_AMP, "<&");
+                    begin(IN_AMP, "<&");
                     ++i;
+                } else if (next_char == '<' && i + 2 < len && input[i + 2] == '<') {
+                    begin(HERESTRING, "<<<");
+                    i += 2;
+                } else if (next_char == '<') {
+                    pending_heredoc heredoc{};
+                    heredoc.strip_tabs = i + 2 < len && input[i + 2] == '-';
+                    begin(HEREDOC, heredoc.strip_tabs ? "<<-" : "<<");
+                    i = heredoc_delimiter(i + (heredoc.strip_tabs ? 3 : 2), heredoc) - 1;
+                    begin(EMPTY);
+                    heredoc.index = tokens.size() - 1;
+                    heredocs.push_back(std::move(heredoc));
                 } else {
-                    current_token = Token(IN, "<");
+                    begin(IN, "<");
                 }
                 break;
             case ';':
-                tokens.push_back(current_token);
-                current_token = Token(SEMICOLON, ";");
+                begin(SEMICOLON, ";");
                 break;
             case '\"':
-                tokens.push_back(current_token);
-                current_token = Token(DQSTRING);
+                begin(DQSTRING);
                 open_until = '\"';
                 break;
             case '\'':
-                tokens.push_back(current_token);
-                current_token = Token(SQSTRING);
+                begin(SQSTRING);
                 open_until = '\'';
                 break;
             case '=':
@@ -221,66 +525,106 @@ tokens_t lexer(const std::string &input) {
                     }
                 }
                 if (current_token.type == EMPTY) {
-                    tokens.push_back(current_token);
-                    current_token = Token(WORD);
+                    begin(WORD);
                 }
-                current_token.value += current_char;
+                append(current_char);
                 break;
             case '#':
+                if (current_token.get_flag(WORD_LIKE) || current_token.type == VAR_DECL) {
+                    // Only starts a comment at the beginning of a word, e.g. `$#` is a special parameter
+                    append(current_char);
+                    break;
+                }
                 if (open_until == '\0') {
-                    tokens.push_back(current_token);
+                    // The current token is kept, so push a copy of it
+                    finish();
+                    if (skip_leading) {
+                        skip_leading = false;
+                    } else {
+                        tokens.push_back(current_token);
+                    }
                     while (i < len && input[i] != '\n') {
                         i++;
                     }
+                    current_token = Token();
+                    token_start = w;
+                    // The newline still separates commands
+                    if (i < len) {
+                        i--;
+                    }
                 }
                 break;
             case '(':
-                tokens.push_back(current_token);
-                current_token = Token(SUBOPEN, "(");
+                begin(SUBOPEN, "(");
                 break;
             case ')':
-                tokens.push_back(current_token);
-                current_token = Token(SUBCLOSE, ")");
+                begin(SUBCLOSE, ")");
                 break;
+            case '\n': {
+                auto last = current_token.type != EMPTY ? &current_token : nullptr;
+                for (auto it = tokens.rbegin(); last == nullptr && it != tokens.rend(); ++it) {
+                    if (it->type != EMPTY) {
+                        last = &*it;
+                    }
+                }
+                if (last != nullptr && !last->get_flag(COMMAND_SEPARATOR)) {
+                    begin(SEMICOLON, ";");
+                    break;
+                }
+                [[fallthrough]];
+            }
             case ' ':
-                if (current_token.type != EMPTY) {
-                    tokens.push_back(current_token);
-                    current_token = Token(EMPTY);
+            case '\t':
+                if (current_token.type != EMPTY || joined) {
+                    begin(EMPTY);
                 }
                 break;
             default:
-                if (current_token.type == WORD || current_token.type == VAR_DECL) {
-                    current_token.value += current_char;
-                } else {
-                    tokens.push_back(current_token);
-                    current_token = Token(WORD);
-                    current_token.value = current_char;
+                if (current_token.type != WORD && current_token.type != VAR_DECL) {
+                    begin(WORD);
                 }
+                auto end = current_char == '$' && next_char == '{' ? parameter_end(i)
+                                                                   : find_first_of(input, i + 1, word_delimiters);
+                append_run(i, end);
+                i = end - 1;
         }
 
-        if (current_token.get_flag(COMMAND_SEPARATOR) && previous_token.get_flag(COMMAND_SEPARATOR)) {
-            throw msh_exception("unexpected token: " + current_token.value, INTERNAL_ERROR);
+        if (current_token.get_flag(COMMAND_SEPARATOR) && (previous_flags & COMMAND_SEPARATOR)) {
+            finish();
+            throw msh_exception("unexpected token: " + std::string{current_token.value()}, INTERNAL_ERROR);
+        }
+        if (current_char == '\n' && !heredocs.empty()) {
+            i = read_heredocs(i + 1);
+            continue;
         }
         i++;
     }
 
+    // The last token pushed in the loop, e.g. a word followed by the body of a here-document
+    if (!tokens.empty() && tokens.back().type == WORD && command_expected) {
+        tokens.back().set_type(COMMAND);
+        command_expected = is_command_prefix(tokens.back().value());
+    }
     if (current_token.type != EMPTY) {
-        tokens.push_back(current_token);
+        push();
     }
 
     if (!substitutions.empty()) {
         auto top = substitutions.top();
         if (top == '\0') {
-            throw msh_exception("expected ')'", INTERNAL_ERROR);
+            throw msh_incomplete_input("expected ')'");
         } else {
-            throw msh_exception("expected '" + std::string(1, top) + "'", INTERNAL_ERROR);
+            throw msh_incomplete_input("expected '" + std::string(1, top) + "'");
         }
     }
     if (open_until != '\0') {
-        throw msh_exception("unclosed delimiter: " + std::string(1, open_until), INTERNAL_ERROR);
+        throw msh_incomplete_input("unclosed delimiter: " + std::string(1, open_until));
+    }
+    if (!heredocs.empty()) {
+        auto const &delimiter = heredocs.front().delimiter;
+        throw msh_incomplete_input("expected '" + delimiter + "'", delimiter);
     }
 
-    tokens.erase(tokens.begin());
     if (!tokens.empty() && tokens.back().type == WORD && command_expected) {
         tokens.back().set_type(COMMAND);
     }
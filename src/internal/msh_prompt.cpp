@@ -11,6 +11,7 @@
 
 #include "internal/msh_prompt.h"
 #include "internal/msh_error.h"
+#include "internal/msh_internal.h"
 
 #include <boost/date_time/gregorian/gregorian.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -52,16 +53,16 @@ std::string expand_ps1(const std::string &ps1) {
 
         // Check for \u, \s, \v escape sequences, as they require special handling
         if (next == 'u') {
-            auto user = getenv("USER");
-            result += user != nullptr ? user : "";
+            auto user = get_variable("USER");
+            result += user != nullptr ? user->value : "";
             goto next;
         } else if (next == 's') {
-            auto shell = getenv("SHELL");
-            result += shell != nullptr ? shell : "";
+            auto shell = get_variable("SHELL");
+            result += shell != nullptr ? shell->value : "";
             goto next;
         } else if (next == 'v') {
-            auto version = getenv("VERSION");
-            result += version != nullptr ? version : "";
+            auto version = get_variable("VERSION");
+            result += version != nullptr ? version->value : "";
             goto next;
         }
 
@@ -106,8 +107,8 @@ std::string expand_ps1(const std::string &ps1) {
 /**
  * @brief Generate a prompt string.
  *
- * This function generates a prompt string by expanding the PS1 environment variable.
- * If the PS1 environment variable is not set, the default prompt defined in msh_prompt.h is used.
+ * This function generates a prompt string by expanding the PS1 variable.
+ * If the PS1 variable is not set, the default prompt defined in msh_prompt.h is used.
  *
  * @return The generated prompt string.
  */
@@ -122,10 +123,10 @@ std::string generate_prompt() {
     rl_get_screen_size(nullptr, &cols);
 
     std::string prompt;
-    if (auto ps1 = getenv("PS1"); ps1 == nullptr) {
+    if (auto ps1 = get_variable("PS1"); ps1 == nullptr) {
         prompt = expand_ps1(DEFAULT_PS1);
     } else {
-        prompt = expand_ps1(ps1);
+        prompt = expand_ps1(ps1->value);
     }
 
     auto marker_color = msh_errno == 0 ? "\033[32m" : "\033[31m";
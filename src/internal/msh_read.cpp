@@ -0,0 +1,131 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Buffered input of `mread`.
+ *
+ * Regular files are read ahead in blocks of MSH_READ_BUFFER_SIZE bytes, and the buffer of
+ * a file descriptor is kept between reads. The bytes read ahead but not consumed are given
+ * back with lseek() before anything else may read from the file descriptor: before it is
+ * redirected, before a process is started and when the shell exits. Other files, e.g. pipes
+ * and terminals, can't be given back to, so they are read one byte at a time.
+ */
+
+#include "internal/msh_read.h"
+#include "internal/msh_output.h"
+#include "types/msh_exception.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    struct read_buffer {
+        std::unique_ptr<char[]> data{new char[MSH_READ_BUFFER_SIZE]};
+        size_t start = 0; ///< First unconsumed byte
+        size_t end = 0;
+    };
+
+    /**
+     * @brief Read-ahead buffers, keyed by file descriptor. Only regular files are buffered.
+     */
+    std::map<int, read_buffer> buffers;
+
+    ssize_t read_retry(int fd, char *data, size_t size) {
+        // The output may be a prompt for the input
+        msh_out.flush();
+        ssize_t res;
+        while ((res = read(fd, data, size)) == -1 && errno == EINTR) {}
+        if (res == -1) {
+            throw msh_exception(strerror(errno));
+        }
+        return res;
+    }
+
+    bool read_unbuffered(int fd, char delimiter, std::string &record) {
+        char c;
+        while (read_retry(fd, &c, 1) == 1) {
+            if (c == delimiter) {
+                return true;
+            }
+            record += c;
+        }
+        return false;
+    }
+}
+
+/**
+ * @brief Read a record terminated by @p delimiter from @p fd.
+ *
+ * @param fd The file descriptor to read from.
+ * @param delimiter The terminating character, not stored in @p record.
+ * @param record Replaced with the record, possibly partial if the end of the file is reached.
+ * @return True if the delimiter was found, false if the end of the file was reached first.
+ *
+ * @throws msh_exception if an error occurs.
+ */
+bool read_record(int fd, char delimiter, std::string &record) {
+    record.clear();
+    auto it = buffers.find(fd);
+    if (it == buffers.end()) {
+        struct stat st{};
+        if (fstat(fd, &st) == -1) {
+            throw msh_exception(strerror(errno));
+        }
+        if (!S_ISREG(st.st_mode)) {
+            return read_unbuffered(fd, delimiter, record);
+        }
+        it = buffers.try_emplace(fd).first;
+    }
+
+    auto &buffer = it->second;
+    while (true) {
+        auto pending = buffer.data.get() + buffer.start;
+        auto size = buffer.end - buffer.start;
+        if (auto found = static_cast<char *>(memchr(pending, delimiter, size)); found != nullptr) {
+            record.append(pending, found);
+            buffer.start += found - pending + 1;
+            return true;
+        }
+        record.append(pending, size);
+        buffer.start = buffer.end = 0;
+
+        auto read_bytes = read_retry(fd, buffer.data.get(), MSH_READ_BUFFER_SIZE);
+        if (read_bytes == 0) {
+            return false;
+        }
+        buffer.end = read_bytes;
+    }
+}
+
+/**
+ * @brief Give back the bytes read ahead from @p fd and drop its buffer.
+ *
+ * Must be called before @p fd is redirected or read by anything but read_record().
+ */
+void read_buffer_release(int fd) {
+    auto it = buffers.find(fd);
+    if (it == buffers.end()) {
+        return;
+    }
+    if (auto unread = it->second.end - it->second.start; unread != 0) {
+        lseek(fd, -static_cast<off_t>(unread), SEEK_CUR);
+    }
+    buffers.erase(it);
+}
+
+/**
+ * @brief Give back the bytes read ahead from all file descriptors, e.g. before starting a process.
+ */
+void read_buffers_release() {
+    while (!buffers.empty()) {
+        read_buffer_release(buffers.begin()->first);
+    }
+}
@@ -4,13 +4,24 @@
 /**
  * @file
  * @brief Redirects related utilities.
+ *
+ * Redirections are parsed from the tokens of a command by parse_redirects() and compiled
+ * into a redirect_plan in the shell process, which is then applied either in the shell
+ * itself, in a forked child or by posix_spawn().
+ *
+ * Here-documents and here-strings are written by the shell before the command starts, so
+ * neither a temporary file nor a writer process is needed, see open_document().
  */
 
 #include "internal/msh_redirects.h"
+#include "internal/msh_output.h"
+#include "internal/msh_read.h"
 #include "types/msh_exception.h"
 
 #include <algorithm>
 
+#include <sys/mman.h>
+
 
 /**
  * @brief Parse redirects from command's tokens.
@@ -51,6 +62,17 @@
  * redirection error occurs. If `n` is omitted, and `word` does not specify a
  * file descriptor, the redirect is equivalent to `&>word`.
  *
+ * <li> Here-documents:<br>
+ * `n<<word` - Make the body of the here-document the input on file descriptor `n`.
+ * If `n` is omitted, it defaults to 0. The body is read by the lexer, see lexer().
+ *
+ * <li> Here-strings:<br>
+ * `n<<<word` - Make `word` followed by a newline the input on file descriptor `n`.
+ * If `n` is omitted, it defaults to 0.
+ *
+ * The tokens consumed by the redirects (file descriptor numbers and targets) are turned into
+ * EMPTY tokens in place, so they don't end up in the command arguments.
+ *
  * @param tokens  The tokens to parse.
  * @return redirects_t The structure containing the parsed redirects.
  */
@@ -64,7 +86,7 @@ redirects_t parse_redirects(tokens_t &tokens) {
 
     redirects_t redirects;
     for (auto it = tokens.begin(); it != tokens.end(); ++it) {
-        auto token = *it;
+        auto const &token = *it;
         if (!token.get_flag(REDIRECT)) {
             continue;
         }
@@ -73,20 +95,18 @@ redirects_t parse_redirects(tokens_t &tokens) {
 
         auto is_amp_x = token.type == TokenType::AMP_OUT || token.type == TokenType::AMP_APPEND;
         if (auto prev = (it - 1); it != tokens.begin() && !is_amp_x) {
-            if (prev->get_flag(WORD_LIKE) && all_digits(prev->value)) {
+            if (prev->get_flag(WORD_LIKE) && all_digits(prev->value())) {
                 int fd;
                 bool is_fd = true;
                 try {
-                    fd = std::stoi(prev->value);
+                    fd = std::stoi(std::string{prev->value()});
                 } catch (const std::exception &) {
                     is_fd = false;
                 }
 
                 if (is_fd) {
                     r.in.fd = fd;
-                    tokens.erase(prev);
-                    --it;
-                    token = *it;
+                    prev->set_type(TokenType::EMPTY);
                 }
             }
         }
@@ -95,33 +115,236 @@ redirects_t parse_redirects(tokens_t &tokens) {
         next_word = find_if(it + 1, tokens.end(),[](Token const &t) { return t.get_flag(WORD_LIKE); });
 
         if (next_word == tokens.end()) {
-            throw msh_exception("parse error near " + token.value, INTERNAL_ERROR);
+            throw msh_exception("parse error near " + std::string{token.value()}, INTERNAL_ERROR);
         }
 
         auto is_x_amp = token.type == TokenType::OUT_AMP || token.type == TokenType::IN_AMP;
         if (is_x_amp) {
-            if (all_digits(next_word->value)) {
+            if (all_digits(next_word->value())) {
                 int fd;
                 try {
-                    fd = std::stoi(next_word->value);
+                    fd = std::stoi(std::string{next_word->value()});
                 } catch (const std::exception &) {
-                    throw msh_exception("Invalid file descriptor: " + next_word->value, INTERNAL_ERROR);
+                    throw msh_exception("Invalid file descriptor: " + std::string{next_word->value()}, INTERNAL_ERROR);
                 }
 
                 r.out.fd = fd;
             } else if (token.type == TokenType::OUT_AMP) {
                 r.both_err_out = true;
-                r.out.path = next_word->value;
+                r.out.path = next_word->value();
             } else {
-                throw msh_exception(next_word->value + ": ambiguous redirect", INTERNAL_ERROR);
+                throw msh_exception(std::string{next_word->value()} + ": ambiguous redirect", INTERNAL_ERROR);
+            }
+        } else if (r.type == redirect::HERE) {
+            r.document = next_word->value();
+            if (token.type == TokenType::HERESTRING) {
+                r.document += '\n';
             }
         } else {
-            r.out.path = next_word->value;
+            r.out.path = next_word->value();
         }
 
-        tokens.erase(next_word);
+        next_word->set_type(TokenType::EMPTY);
         redirects.push_back(r);
     }
 
     return redirects;
 }
+
+
+namespace {
+    /**
+     * @brief Create a file descriptor reading @p document from the start.
+     *
+     * A document of up to MSH_HEREDOC_PIPE_SIZE bytes is written into a pipe, which holds it
+     * without a reader. A larger one, or one that doesn't fit into the pipe, is written into
+     * a memfd_create(2) file sealed against any change, so readers may share it safely.
+     *
+     * @return The file descriptor, with O_CLOEXEC set, or -1 on error with @c errno set.
+     */
+    int open_document(std::string_view document) {
+        if (int fds[2]; document.size() <= MSH_HEREDOC_PIPE_SIZE && pipe2(fds, O_CLOEXEC | O_NONBLOCK) == 0) {
+            auto written = document.empty() ? 0 : write(fds[1], document.data(), document.size());
+            close(fds[1]);
+            if (written == static_cast<ssize_t>(document.size())) {
+                // Only the write end had to be non-blocking
+                fcntl(fds[0], F_SETFL, 0);
+                return fds[0];
+            }
+            close(fds[0]);
+        }
+
+        int fd = memfd_create("msh-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd == -1) {
+            return -1;
+        }
+        for (size_t pos = 0; pos < document.size();) {
+            auto written = write(fd, document.data() + pos, document.size() - pos);
+            if (written == -1 && errno != EINTR) {
+                auto error = errno;
+                close(fd);
+                errno = error;
+                return -1;
+            }
+            pos += written == -1 ? 0 : static_cast<size_t>(written);
+        }
+        if (lseek(fd, 0, SEEK_SET) == -1 ||
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+            auto error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        return fd;
+    }
+}
+
+redirect_plan::~redirect_plan() {
+    close_opened();
+    for (auto [fd, copy]: saved) {
+        if (copy != -1) {
+            close(copy);
+        }
+    }
+}
+
+void redirect_plan::close_opened() {
+    std::ranges::for_each(opened, close);
+    opened.clear();
+}
+
+/**
+ * @brief Open the redirection targets and plan the dup2() calls.
+ *
+ * Errors are reported here, in the shell process, e.g. a file that can't be opened or
+ * a file descriptor to duplicate that is not open.
+ *
+ * The bodies of here-documents are written out here as well, see open_document().
+ *
+ * @param redirects The redirections, in the order they are written.
+ * @return 0 on success, 1 on error.
+ */
+int redirect_plan::compile(const redirects_t &redirects) {
+    max_target = STDERR_FILENO;
+    for (auto const &redirect: redirects) {
+        max_target = std::max(max_target, redirect.in.fd);
+    }
+
+    auto redirected = [this](int fd) {
+        return std::ranges::any_of(steps, [fd](const step &s) { return s.to == fd; });
+    };
+
+    for (auto const &redirect: redirects) {
+        if (redirect.type == redirect::NONE) {
+            continue;
+        }
+
+        int from = redirect.out.fd;
+        if (redirect.type == redirect::HERE) {
+            from = open_document(redirect.document);
+            if (from == -1) {
+                msh_error("cannot create here-document: " + std::string(strerror(errno)));
+                return 1;
+            }
+        } else if (from == -1) {
+            auto [flags, mode] = redirect.open_flags();
+            from = open(redirect.out.path.c_str(), flags | O_CLOEXEC, mode);
+            if (from == -1) {
+                msh_error("cannot open " + redirect.out.path + ": " + strerror(errno));
+                return 1;
+            }
+        }
+        if (from != redirect.out.fd) {
+            opened.push_back(from);
+            if (from <= max_target) {
+                // Moved out of the way of the file descriptors being redirected
+                from = fcntl(from, F_DUPFD_CLOEXEC, max_target + 1);
+                if (from == -1) {
+                    msh_error("cannot redirect: " + std::string(strerror(errno)));
+                    return 1;
+                }
+                close(opened.back());
+                opened.back() = from;
+            }
+        } else if (!redirected(from) && fcntl(from, F_GETFD) == -1) {
+            msh_error(std::to_string(from) + ": " + strerror(errno));
+            return 1;
+        }
+
+        steps.push_back({from, redirect.in.fd});
+        if (redirect.both_err_out) {
+            steps.push_back({STDOUT_FILENO, STDERR_FILENO});
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Issue the dup2() calls of the plan.
+ *
+ * Async-signal-safe, may be called in a child of fork() or vfork().
+ *
+ * @return 0 on success, 1 on error, with @c errno set.
+ */
+int redirect_plan::apply() const {
+    for (auto [from, to]: steps) {
+        if (dup2(from, to) == -1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Apply the plan in the shell process, saving the file descriptors it redirects.
+ *
+ * The pending output of the shell is written out and the input read ahead from the
+ * affected file descriptors is given back first.
+ *
+ * @return 0 on success, 1 on error. undo() must be called in both cases.
+ *
+ * @see read_buffer_release
+ */
+int redirect_plan::perform() {
+    if (steps.empty()) {
+        return 0;
+    }
+
+    msh_out.flush();
+    for (auto [from, to]: steps) {
+        read_buffer_release(from);
+        read_buffer_release(to);
+        if (std::ranges::none_of(saved, [to](auto const &s) { return s.first == to; })) {
+            // Placed above all redirected file descriptors, -1 if the descriptor is not open
+            saved.emplace_back(to, fcntl(to, F_DUPFD_CLOEXEC, max_target + 1));
+        }
+    }
+
+    auto res = apply();
+    if (res != 0) {
+        msh_error("cannot redirect: " + std::string(strerror(errno)));
+    }
+    close_opened();
+    return res;
+}
+
+/**
+ * @brief Restore the file descriptors saved by perform().
+ */
+void redirect_plan::undo() {
+    if (saved.empty()) {
+        return;
+    }
+
+    msh_out.flush();
+    for (auto [fd, copy]: saved) {
+        read_buffer_release(fd);
+        if (copy == -1) {
+            close(fd);
+        } else {
+            dup2(copy, fd);
+            close(copy);
+        }
+    }
+    saved.clear();
+}
@@ -0,0 +1,181 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Vectorized byte scanning utilities.
+ *
+ * The scanner implementation is picked once at runtime: AVX2 if the CPU supports it,
+ * SSE2 on any other x86-64 CPU and a scalar loop everywhere else.
+ */
+
+#include "internal/msh_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MSH_SCAN_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Construct a byte set from the given bytes.
+ *
+ * The AVX2 scanner classifies bytes by their nibbles: every distinct high nibble of the set
+ * gets its own bit, and a byte belongs to the set if the bit of its high nibble is present in
+ * the entry of its low nibble. That is exact as long as there are at most 8 distinct high
+ * nibbles, otherwise the AVX2 scanner is not used for the set.
+ *
+ * @param set Bytes of the set.
+ */
+byte_set::byte_set(std::string_view set) {
+    std::array<int, 16> high_bit{};
+    high_bit.fill(-1);
+    int next_bit = 0;
+
+    for (auto c: set) {
+        auto byte = static_cast<unsigned char>(c);
+        if (table[byte]) {
+            continue;
+        }
+        table[byte] = true;
+        bytes += c;
+
+        auto hi = byte >> 4;
+        auto lo = byte & 0x0F;
+        if (high_bit[hi] == -1) {
+            if (next_bit == 8) {
+                nibble_lookup = false;
+                continue;
+            }
+            high_bit[hi] = next_bit++;
+        }
+        auto bit = static_cast<uint8_t>(1 << high_bit[hi]);
+        // The tables are duplicated into both 128-bit lanes, as vpshufb works per lane
+        lo_nibbles[lo] |= bit;
+        lo_nibbles[lo + 16] |= bit;
+        hi_nibbles[hi] = bit;
+        hi_nibbles[hi + 16] = bit;
+    }
+}
+
+namespace {
+    using scanner_t = size_t (*)(const char *, size_t, const byte_set &);
+
+    /**
+     * @tparam Member Whether to search for a byte that belongs to the set or one that does not.
+     */
+    template<bool Member>
+    size_t scan_scalar(const char *data, size_t len, const byte_set &set) {
+        for (size_t i = 0; i < len; ++i) {
+            if (set.contains(data[i]) == Member) {
+                return i;
+            }
+        }
+        return len;
+    }
+
+#ifdef MSH_SCAN_X86
+    template<bool Member>
+    __attribute__((target("sse2")))
+    size_t scan_sse2(const char *data, size_t len, const byte_set &set) {
+        if (set.bytes.size() > 16) {
+            return scan_scalar<Member>(data, len, set);
+        }
+
+        size_t i = 0;
+        for (; i + 16 <= len; i += 16) {
+            auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            auto found = _mm_setzero_si128();
+            for (auto c: set.bytes) {
+                found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)));
+            }
+            auto mask = static_cast<unsigned>(_mm_movemask_epi8(found));
+            if (!Member) {
+                mask ^= 0xFFFF;
+            }
+            if (mask != 0) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return i + scan_scalar<Member>(data + i, len - i, set);
+    }
+
+    template<bool Member>
+    __attribute__((target("avx2")))
+    size_t scan_avx2(const char *data, size_t len, const byte_set &set) {
+        if (!set.nibble_lookup) {
+            return scan_sse2<Member>(data, len, set);
+        }
+
+        auto lo_table = _mm256_load_si256(reinterpret_cast<const __m256i *>(set.lo_nibbles.data()));
+        auto hi_table = _mm256_load_si256(reinterpret_cast<const __m256i *>(set.hi_nibbles.data()));
+        auto low_mask = _mm256_set1_epi8(0x0F);
+        auto zero = _mm256_setzero_si256();
+
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            auto lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(chunk, low_mask));
+            auto hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), low_mask));
+            auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero)));
+            if (Member) {
+                mask = ~mask;
+            }
+            if (mask != 0) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return i + scan_scalar<Member>(data + i, len - i, set);
+    }
+#endif
+
+    template<bool Member>
+    scanner_t select_scanner() {
+#ifdef MSH_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return scan_avx2<Member>;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return scan_sse2<Member>;
+        }
+#endif
+        return scan_scalar<Member>;
+    }
+}
+
+/**
+ * @brief Find the first byte of @p input starting at @p pos that belongs to @p set.
+ *
+ * @param input The input to search in.
+ * @param pos Position to start the search at.
+ * @param set The set of bytes to search for.
+ * @return Position of the first matching byte or the length of @p input if there is none.
+ */
+size_t find_first_of(std::string_view input, size_t pos, const byte_set &set) {
+    static const scanner_t scanner = select_scanner<true>();
+
+    if (pos >= input.size()) {
+        return input.size();
+    }
+    return pos + scanner(input.data() + pos, input.size() - pos, set);
+}
+
+/**
+ * @brief Find the first byte of @p input starting at @p pos that does not belong to @p set.
+ *
+ * @param input The input to search in.
+ * @param pos Position to start the search at.
+ * @param set The set of bytes to skip.
+ * @return Position of the first byte not in the set or the length of @p input if there is none.
+ */
+size_t find_first_not_of(std::string_view input, size_t pos, const byte_set &set) {
+    static const scanner_t scanner = select_scanner<false>();
+
+    if (pos >= input.size()) {
+        return input.size();
+    }
+    return pos + scanner(input.data() + pos, input.size() - pos, set);
+}
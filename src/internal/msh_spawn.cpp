@@ -0,0 +1,113 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Spawning of external commands.
+ *
+ * External commands are launched with posix_spawn(), which doesn't copy the address space
+ * of the shell. Everything the child would otherwise do between fork() and execve(),
+ * i.e. opening the redirection targets and arranging file descriptors, is planned
+ * in the parent beforehand, see redirect_plan.
+ */
+
+#include "internal/msh_spawn.h"
+#include "internal/msh_exec.h"
+#include "internal/msh_internal.h"
+#include "types/msh_command.h"
+
+#include <spawn.h>
+#include <fcntl.h>
+#include <csignal>
+
+namespace {
+    /**
+     * @brief File actions performed in the child of posix_spawn() before execve().
+     */
+    struct spawn_actions {
+        posix_spawn_file_actions_t actions{};
+
+        spawn_actions() {
+            posix_spawn_file_actions_init(&actions);
+        }
+
+        ~spawn_actions() {
+            posix_spawn_file_actions_destroy(&actions);
+        }
+
+        spawn_actions(const spawn_actions &) = delete;
+
+        spawn_actions &operator=(const spawn_actions &) = delete;
+    };
+}
+
+/**
+ * @brief Launch an external command using posix_spawn().
+ *
+ * @param cmd The command to launch. Must not be a builtin.
+ * @param redirects The compiled redirections of the command, applied after the pipes.
+ * @param path Location of the command found in PATH, @c nullptr if it was not found.
+ * Ignored if the command contains a slash.
+ * @param pipe_in File descriptor to use as stdin.
+ * @param pipe_out File descriptor to use as stdout.
+ * @param flags Flags to pass to the command.
+ * @return PID of the launched process, or 0 if the command has to be executed by msh_execve()
+ * in a forked child instead.
+ *
+ * The process is put into the process group @c exec_pgid.
+ *
+ * Only the successful launch is handled here. If the command can't be launched, e.g. it is not
+ * found or it is a script (ENOEXEC), the forked child reports the error or executes the script
+ * after the redirections are performed, exactly as without this fast path.
+ *
+ * @see msh_exec_simple
+ * @see msh_execve
+ */
+pid_t msh_spawn(simple_command &cmd, const redirect_plan &redirects, const char *path, int pipe_in, int pipe_out,
+                int flags) {
+    spawn_actions plan;
+
+    if (pipe_in != STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&plan.actions, pipe_in, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&plan.actions, pipe_in);
+    }
+    if (pipe_out != STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&plan.actions, pipe_out, STDOUT_FILENO);
+        if (flags & PIPE_STDERR) {
+            posix_spawn_file_actions_adddup2(&plan.actions, pipe_out, STDERR_FILENO);
+        }
+        posix_spawn_file_actions_addclose(&plan.actions, pipe_out);
+    }
+    for (auto [from, to]: redirects.get_steps()) {
+        posix_spawn_file_actions_adddup2(&plan.actions, from, to);
+    }
+
+    auto name = cmd.argv_c[0];
+    if (strchr(name, '/') != nullptr) {
+        path = name;
+    } else if (path == nullptr) {
+        return 0;
+    }
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    short attr_flags = POSIX_SPAWN_SETSIGMASK;
+    if (exec_pgid != -1) {
+        attr_flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, exec_pgid);
+    }
+    // The child must not inherit SIGCHLD blocked by sigchld_guard
+    sigset_t mask;
+    sigprocmask(SIG_SETMASK, nullptr, &mask);
+    sigdelset(&mask, SIGCHLD);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr, attr_flags);
+
+    pid_t pid;
+    auto err = posix_spawn(&pid, path, &plan.actions, &attr, cmd.argv_c.data(), msh_environ());
+    posix_spawnattr_destroy(&attr);
+    return err == 0 ? pid : 0;
+}
@@ -0,0 +1,570 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
+
+//
+// Created by andrew on 10/17/26.
+//
+/**
+ * @file
+ * @brief Command substitution.
+ *
+ * The output of the substituted command is read while the command is running, so it can't
+ * block on a full pipe. Small outputs are collected on the heap, larger ones are spliced
+ * into a memfd and mapped into memory once complete.
+ *
+ * Independent substitutions of one command run concurrently, see substitution_queue.
+ *
+ * `$(<file)` doesn't start a subshell, the file is read by the shell itself. Large regular
+ * files are mapped into memory.
+ *
+ * Process substitutions `<(cmd)` and `>(cmd)` connect a subshell to a pipe and are replaced
+ * with the `/dev/fd/N` path of its other end, which is inherited by the consuming command.
+ *
+ * @see MSH_SUBST_SPILL_THRESHOLD
+ * @see MSH_SUBST_MMAP_THRESHOLD
+ */
+
+#include "internal/msh_subst.h"
+#include "internal/msh_parser.h"
+#include "internal/msh_output.h"
+#include "internal/msh_read.h"
+#include "types/msh_command.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+namespace {
+    constexpr size_t READ_SIZE = 64 << 10;
+    constexpr size_t SPLICE_SIZE = 1 << 20;
+    constexpr int PIPE_SIZE = 1 << 20;
+
+    /**
+     * @brief A process substitution whose subshell is not reaped yet.
+     */
+    struct process_substitution {
+        pid_t pid;
+        int fd; ///< The end of the pipe left to the consuming command, -1 once closed
+    };
+
+    /**
+     * @brief Process substitutions of the commands being executed, the innermost ones last.
+     */
+    std::vector<process_substitution> process_substitutions;
+
+    /**
+     * @brief Number of process_substitution_scope objects alive.
+     */
+    int process_substitution_scopes = 0;
+
+    /**
+     * @brief Growing heap buffer. Unlike @c std::string, doesn't initialize the memory it grows by.
+     */
+    struct capture_buffer {
+        char *data = nullptr;
+        size_t size = 0;
+        size_t capacity = 0;
+
+        capture_buffer() = default;
+
+        ~capture_buffer() {
+            free(data);
+        }
+
+        capture_buffer(const capture_buffer &) = delete;
+
+        capture_buffer &operator=(const capture_buffer &) = delete;
+
+        /**
+         * @brief Make sure at least @p n more bytes fit into the buffer.
+         */
+        void reserve(size_t n) {
+            if (size + n <= capacity) {
+                return;
+            }
+            auto new_capacity = std::max(capacity * 2, size + n);
+            auto new_data = static_cast<char *>(realloc(data, new_capacity));
+            if (new_data == nullptr) {
+                throw msh_exception("command substitution: out of memory");
+            }
+            data = new_data;
+            capacity = new_capacity;
+        }
+
+        /**
+         * @brief Hand the buffer over to an arena.
+         */
+        arena_t release() {
+            auto arena = arena_t(data, free);
+            data = nullptr;
+            size = capacity = 0;
+            return arena;
+        }
+    };
+
+    /**
+     * @brief Check whether the command may be executed in the shell process with its output captured.
+     *
+     * That's the case for a single builtin flagged as NO_SIDE_EFFECTS without redirections
+     * or variable assignments, e.g. `$(mpwd)`.
+     *
+     * @param cmd The parsed command.
+     * @return True if the command doesn't need a subshell, false otherwise.
+     */
+    bool runs_in_process(const command &cmd) {
+        auto simple = std::get_if<simple_command_ptr>(&cmd.cmd);
+        if (simple == nullptr || *simple == nullptr) {
+            return false;
+        }
+
+        auto const &tokens = (*simple)->tokens;
+        bool builtin_found = false;
+        for (auto it = tokens.begin(); it != tokens.end(); ++it) {
+            if (it->get_flag(REDIRECT) || it->type == TokenType::VAR_DECL) {
+                return false;
+            }
+            if (it->type == TokenType::COMMAND) {
+                auto builtin = builtin_commands.find(it->value());
+                if (builtin == builtin_commands.end() || !builtin->second.get_flag(NO_SIDE_EFFECTS)) {
+                    return false;
+                }
+                // The name must not be squashed with the following word
+                if (it + 1 != tokens.end() && (it + 1)->type != TokenType::EMPTY) {
+                    return false;
+                }
+                builtin_found = true;
+            }
+        }
+        return builtin_found;
+    }
+
+    /**
+     * @brief Check whether the command is `<file` alone, i.e. the substitution is `$(<file)`.
+     *
+     * @param cmd The parsed command.
+     * @return True if the command consists of a single input redirection, false otherwise.
+     */
+    bool reads_file(const command &cmd) {
+        auto simple = std::get_if<simple_command_ptr>(&cmd.cmd);
+        if (simple == nullptr || *simple == nullptr) {
+            return false;
+        }
+
+        auto const &tokens = (*simple)->tokens;
+        auto it = std::ranges::find_if(tokens, [](const Token &t) { return t.type != TokenType::EMPTY; });
+        if (it == tokens.end() || it->type != TokenType::IN) {
+            return false;
+        }
+        it = std::find_if(it + 1, tokens.end(), [](const Token &t) { return t.type != TokenType::EMPTY; });
+        // The target may be made of several squashed words, e.g. `"$dir"/file`
+        bool target_found = false;
+        for (; it != tokens.end() && it->type != TokenType::EMPTY; ++it) {
+            if (!it->get_flag(WORD_LIKE)) {
+                return false;
+            }
+            target_found = true;
+        }
+        return target_found && std::all_of(it, tokens.end(), [](const Token &t) {
+            return t.type == TokenType::EMPTY;
+        });
+    }
+
+    /**
+     * @brief Read the rest of the output from @p fd into a memfd and map it into memory.
+     *
+     * @param fd The read end of the pipe.
+     * @param buffer The output read so far, moved into the memfd first.
+     * @return The mapped output.
+     *
+     * @throws msh_exception if an error occurs.
+     */
+    captured_output spill(int fd, capture_buffer &buffer) {
+        auto error = [](const char *what) {
+            return msh_exception("command substitution: " + std::string(what) + ": " + strerror(errno));
+        };
+
+        int memfd = memfd_create("msh-subst", MFD_CLOEXEC);
+        if (memfd == -1) {
+            throw error("memfd_create");
+        }
+        // Closes the memfd on any exit, the mapping stays valid
+        auto memfd_closer = std::unique_ptr<int, void (*)(const int *)>(&memfd, [](const int *fd) { close(*fd); });
+
+        for (std::string_view pending{buffer.data, buffer.size}; !pending.empty();) {
+            auto written = write(memfd, pending.data(), pending.size());
+            if (written == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw error("write");
+            }
+            pending.remove_prefix(written);
+        }
+        size_t size = buffer.size;
+        // Reused as the bounce buffer if splice is not supported
+        buffer.size = 0;
+
+        bool can_splice = true;
+        while (true) {
+            ssize_t moved;
+            if (can_splice) {
+                moved = splice(fd, nullptr, memfd, nullptr, SPLICE_SIZE, SPLICE_F_MOVE);
+                if (moved == -1 && errno == EINVAL) {
+                    can_splice = false;
+                    continue;
+                }
+            } else {
+                buffer.reserve(READ_SIZE);
+                moved = read(fd, buffer.data, READ_SIZE);
+                if (moved > 0 && write(memfd, buffer.data, moved) != moved) {
+                    throw error("write");
+                }
+            }
+
+            if (moved == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw error("read");
+            }
+            if (moved == 0) {
+                break;
+            }
+            size += moved;
+        }
+
+        auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, memfd, 0);
+        if (data == MAP_FAILED) {
+            throw error("mmap");
+        }
+        auto arena = arena_t(static_cast<const char *>(data), [size](const char *p) {
+            munmap(const_cast<char *>(p), size);
+        });
+        return {arena, {arena.get(), size}};
+    }
+
+    /**
+     * @brief Read the whole output of the command from @p fd.
+     *
+     * Reads directly into a growing buffer. Once the output exceeds MSH_SUBST_SPILL_THRESHOLD,
+     * it is moved into a memfd instead.
+     *
+     * @param fd The read end of the pipe.
+     * @return The output of the command.
+     *
+     * @throws msh_exception if an error occurs.
+     */
+    captured_output read_output(int fd) {
+        capture_buffer buffer;
+        while (true) {
+            if (buffer.size >= MSH_SUBST_SPILL_THRESHOLD) {
+                return spill(fd, buffer);
+            }
+
+            buffer.reserve(READ_SIZE);
+            auto read_bytes = read(fd, buffer.data + buffer.size, buffer.capacity - buffer.size);
+            if (read_bytes == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw msh_exception("command substitution: " + std::string{strerror(errno)});
+            }
+            if (read_bytes == 0) {
+                break;
+            }
+            buffer.size += read_bytes;
+        }
+
+        auto size = buffer.size;
+        auto arena = buffer.release();
+        return {arena, {arena.get(), size}};
+    }
+
+    /**
+     * @brief Read the file @p path for `$(<file)`.
+     *
+     * Regular files of at least MSH_SUBST_MMAP_THRESHOLD bytes are mapped into memory,
+     * anything else is read like the output of a command.
+     *
+     * @param path The file to read.
+     * @return The contents of the file.
+     *
+     * @throws msh_exception if the file can't be read.
+     */
+    captured_output read_file(const std::string &path) {
+        auto error = [&path]() {
+            return msh_exception(path + ": " + strerror(errno));
+        };
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw error();
+        }
+        auto fd_closer = std::unique_ptr<int, void (*)(const int *)>(&fd, [](const int *fd) { close(*fd); });
+
+        struct stat st{};
+        if (fstat(fd, &st) == -1) {
+            throw error();
+        }
+        if (!S_ISREG(st.st_mode) || st.st_size < MSH_SUBST_MMAP_THRESHOLD) {
+            return read_output(fd);
+        }
+
+        auto size = static_cast<size_t>(st.st_size);
+        auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            throw error();
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+        auto arena = arena_t(static_cast<const char *>(data), [size](const char *p) {
+            munmap(const_cast<char *>(p), size);
+        });
+        return {arena, {arena.get(), size}};
+    }
+}
+
+/**
+ * @brief Parse the command substitutions of a simple command and start the first ones.
+ *
+ * @param tokens Tokens of a simple command.
+ *
+ * @throws msh_exception if a subshell can't be started.
+ *
+ * @see parse_input
+ */
+substitution_queue::substitution_queue(const tokens_t &tokens) {
+    for (auto const &token: tokens) {
+        if (token.type != TokenType::COM_SUB) {
+            continue;
+        }
+        auto &entry = substitutions.emplace_back();
+        try {
+            entry.cmd = std::make_shared<command>(parse_input(std::string{token.value()}));
+            entry.in_process = runs_in_process(*entry.cmd);
+            entry.reads_file = reads_file(*entry.cmd);
+        } catch (const msh_exception &e) {
+            msh_error(e.what());
+        }
+    }
+    launch();
+}
+
+substitution_queue::~substitution_queue() {
+    for (size_t i = current; i < launched; ++i) {
+        if (substitutions[i].pid > 0) {
+            close(substitutions[i].fd);
+            while (waitpid(substitutions[i].pid, nullptr, 0) == -1 && errno == EINTR) {}
+        }
+    }
+}
+
+/**
+ * @brief Start subshells for the following substitutions, until MSH_SUBST_MAX_JOBS are running.
+ *
+ * The output of a running subshell is not read until it is collected, so it can get ahead
+ * of the shell by the size of the pipe.
+ *
+ * @throws msh_exception if an error occurs.
+ */
+void substitution_queue::launch() {
+    for (; launched < substitutions.size() && running < MSH_SUBST_MAX_JOBS; ++launched) {
+        auto &entry = substitutions[launched];
+        if (entry.cmd == nullptr || entry.in_process || entry.reads_file) {
+            continue;
+        }
+
+        int pipefd[2];
+        if (pipe2(pipefd, O_CLOEXEC) == -1) {
+            throw msh_exception("command substitution: " + std::string{strerror(errno)});
+        }
+        // Fewer wakeups for large outputs, not an error if not permitted
+        fcntl(pipefd[0], F_SETPIPE_SZ, PIPE_SIZE);
+
+        // Don't let the child inherit the pending output of the shell, nor the input read ahead
+        msh_out.flush();
+        read_buffers_release();
+
+        if (!guard) {
+            guard.emplace();
+        }
+        pid_t pid = fork();
+        if (pid == -1) {
+            close(pipefd[0]);
+            close(pipefd[1]);
+            throw msh_exception("command substitution: " + std::string{strerror(errno)});
+        } else if (pid == 0) {
+            unblock_sigchld();
+            dup2(pipefd[1], STDOUT_FILENO);
+            msh_close_shell_fds();
+
+            exec_capture = nullptr;
+            // The substitution may be expanded while a pipeline is being started, its commands
+            // must stay in the process group of the subshell, not start or join the pipeline's one
+            exec_pgid = -1;
+            auto status = entry.cmd->execute();
+            msh_out.flush();
+            _exit(status);
+        }
+        close(pipefd[1]);
+
+        entry.pid = pid;
+        entry.fd = pipefd[0];
+        ++running;
+    }
+}
+
+/**
+ * @brief Collect the output of the next command substitution.
+ *
+ * Reads the output of the subshell while it is running and waits for it afterwards.
+ * Builtins that can be executed in-process, see runs_in_process(), are executed here.
+ * For `$(<file)`, the file is read here. If it can't be read, the output is empty.
+ * Any trailing newlines are removed from the output.
+ *
+ * @return The output of the command, empty if the command failed to parse.
+ *
+ * @throws msh_exception if an error occurs during command execution.
+ */
+captured_output substitution_queue::next() {
+    if (current >= substitutions.size()) {
+        return {};
+    }
+    auto &entry = substitutions[current];
+
+    captured_output output;
+    if (entry.reads_file) {
+        try {
+            auto words = expand_tokens(std::get<simple_command_ptr>(entry.cmd->cmd)->tokens);
+            output = read_file(parse_redirects(words).front().out.path);
+        } catch (const msh_exception &e) {
+            msh_error(e.what());
+        }
+    } else if (entry.in_process) {
+        std::string result;
+        auto saved_capture = exec_capture;
+        auto saved_errno = msh_errno;
+        exec_capture = &result;
+        entry.cmd->execute();
+        exec_capture = saved_capture;
+        msh_errno = saved_errno;
+
+        auto size = result.size();
+        output.arena = make_arena(std::move(result));
+        output.value = {output.arena.get(), size};
+    } else if (entry.pid > 0) {
+        // The destructor waits for the subshell if reading fails
+        output = read_output(entry.fd);
+        close(entry.fd);
+        while (waitpid(entry.pid, nullptr, 0) == -1 && errno == EINTR) {}
+        entry.pid = 0;
+        --running;
+    }
+    ++current;
+    launch();
+
+    while (output.value.ends_with('\n')) {
+        output.value.remove_suffix(1);
+    }
+    return output;
+}
+
+/**
+ * @brief Start the process substitution `<(cmd)` or `>(cmd)`.
+ *
+ * The command is executed in a subshell with its standard output, or its standard input
+ * for `>(cmd)`, connected to a pipe. The other end of the pipe is kept open without
+ * O_CLOEXEC, so the consuming command inherits it and opens it by its path, no file is
+ * created. It is closed by the enclosing process_substitution_scope.
+ *
+ * @param cmd The substituted command.
+ * @param output True for `>(cmd)`, i.e. the consuming command writes to the subshell.
+ * @return The path of the file descriptor, `/dev/fd/N`.
+ *
+ * @throws msh_exception if the command can't be parsed or the subshell can't be started.
+ */
+std::string start_process_substitution(std::string_view cmd, bool output) {
+    auto parsed = parse_input(std::string{cmd});
+
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
+        throw msh_exception("process substitution: " + std::string{strerror(errno)});
+    }
+    int kept = output ? pipefd[1] : pipefd[0];
+    int connected = output ? pipefd[0] : pipefd[1];
+
+    // Don't let the child inherit the pending output of the shell, nor the input read ahead
+    msh_out.flush();
+    read_buffers_release();
+
+    // Keeps the SIGCHLD handler from reaping the subshell before it is added to the process table
+    sigchld_guard guard;
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        throw msh_exception("process substitution: " + std::string{strerror(errno)});
+    } else if (pid == 0) {
+        unblock_sigchld();
+        dup2(connected, output ? STDIN_FILENO : STDOUT_FILENO);
+        msh_close_shell_fds();
+        // Otherwise the subshell may keep the input of another substitution open
+        for (auto const &substitution: process_substitutions) {
+            if (substitution.fd != -1) {
+                close(substitution.fd);
+            }
+        }
+
+        exec_capture = nullptr;
+        // Used in a pipeline stage, the substitution must not start or join the pipeline's process group
+        exec_pgid = -1;
+        auto status = parsed.execute();
+        msh_out.flush();
+        _exit(status);
+    }
+    close(connected);
+    fcntl(kept, F_SETFD, 0);
+
+    add_process(pid, 0, {std::string(output ? ">(" : "<(") + std::string{cmd} + ")"});
+    process_substitutions.push_back({pid, kept});
+    return "/dev/fd/" + std::to_string(kept);
+}
+
+process_substitution_scope::process_substitution_scope(bool wait) :
+        first(process_substitutions.size()), wait(wait) {
+    ++process_substitution_scopes;
+}
+
+/**
+ * @brief Close the file descriptors of the process substitutions started in the scope.
+ */
+void process_substitution_scope::close() {
+    for (size_t i = first; i < process_substitutions.size(); ++i) {
+        if (auto &fd = process_substitutions[i].fd; fd != -1) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+}
+
+process_substitution_scope::~process_substitution_scope() {
+    close();
+    --process_substitution_scopes;
+    if (!wait && process_substitution_scopes != 0) {
+        return;
+    }
+
+    for (size_t i = first; i < process_substitutions.size(); ++i) {
+        sigchld_guard guard;
+        auto pid = process_substitutions[i].pid;
+        // Already reaped by the SIGCHLD handler if done, left to it if not waited for
+        auto it = processes.find(pid);
+        if (wait && it != processes.end() && it->second.status != status::DONE) {
+            int status;
+            wait_for_process(pid, &status);
+        } else {
+            remove_process(pid);
+        }
+    }
+    process_substitutions.resize(first);
+}
@@ -18,140 +18,44 @@
 #include "internal/msh_parser.h"
 #include "internal/msh_exec.h"
 
-#include <glob.h>
+#include <array>
 #include <vector>
-#include <list>
-#include <stack>
+#include <unordered_set>
 #include <algorithm>
-#include <boost/filesystem.hpp>
-#include <boost/date_time.hpp>
 
 
-/**
- * @brief Perform postprocessing on a vector of tokens.
- *
- * Postprocessing can include some specific operations that must be performed after
- * tokenization, but before any other processing steps. For example, variable declarations
- * that appear as `malias` or `mexport` commands are not eligible for word splitting and
- * filename expansion.
- *
- * @param tokens A vector of tokens to postprocess.
- *
- * @see Token
- * @see token_flags
- * @see lexer()
- */
-void postprocess_tokens(tokens_t &tokens) {
-    using enum TokenType;
-    builtin current_command{};
-
-    for (auto it = tokens.begin(); it != tokens.end(); ++it) {
-        if (it->type == COMMAND) {
-            auto builtin = builtin_commands.find(it->value);
-            if (builtin != builtin_commands.end()) {
-                current_command = builtin->second;
-            }
-        }
-        if (it->get_flag(ASSIGNMENT_WORD)) {
-            auto next = it + 1;
-            if (next != tokens.end() &&
-            (it->type == VAR_DECL || current_command.get_flag(DECLARATION_COMMAND))) {
-                next->set_flag(NO_WORD_SPLIT);
-            }
-        }
-    }
-}
-
-/**
- * @brief Insert a sequence of tokens into a vector of tokens on a given position.
- *
- * @param tokens A vector of tokens to insert into.
- * @param pos An iterator pointing to the position to insert tokens at.
- * @param sub_tokens A vector of tokens to insert.
- *
- * @note The iterator is updated to point to the last inserted token. The token on the
- * given position is erased.
- *
- * @see Token
- * @see std::advance
- */
-void insert_tokens(tokens_t &tokens, tokens_t::iterator &pos, const tokens_t &sub_tokens) {
-    pos = tokens.erase(pos);
-    pos = tokens.insert(pos, sub_tokens.begin(), sub_tokens.end());
-    std::advance(pos, sub_tokens.size() - 1);
-}
-
-/**
- * @brief Perform word splitting on the given input string, breaking it down into a vector of WORD tokens.
- *
- * @param input The input string to be split.
- * @return A vector of WORD tokens.
- *
- * @note WORD tokens are separated according to the value of the IFS environment variable, if set,
- * otherwise the delimiters are <space>, <tab> and <newline>. Embedded newlines can be removed
- * during this operation.
- */
-tokens_t split_words(const std::string_view input) {
-    using namespace boost::algorithm;
-    tokens_t tokens;
-
-    const auto ifs = getenv("IFS");
-    std::string delimeters = ifs != nullptr ? ifs : " \t\n";
-
-    std::vector<std::string> words;
-    split(words, input, is_any_of(delimeters), token_compress_on);
-
-    for (auto &word: words) {
-        tokens.emplace_back(TokenType::WORD, std::move(word));
-        tokens.emplace_back(TokenType::EMPTY);
-    }
-    if (!tokens.empty()) {
-        tokens.pop_back();
-    }
-    return tokens;
-}
-
-/**
- * @brief Sets internal variables based on VAR_DECL tokens in a vector of tokens.
- *
- * Iterates through a vector of tokens, identifies VAR_DECL tokens, and sets corresponding
- * variables based on their values. If a VAR_DECL token is followed by a token flagged as WORD_LIKE
- * without separators, the two tokens are combined and the resulting string is assigned to the variable.
- *
- * @param tokens A vector of tokens to process and update variable values.
- * @note VAR_DECL tokens are removed from the vector after processing.
- *
- * @see Token
- * @see token_flags
- * @see set_variable
- */
-void set_variables(tokens_t &tokens) {
-    for (auto it = tokens.begin(); it != tokens.end(); ++it) {
-        auto &token = *it;
-        if (token.type == TokenType::VAR_DECL) {
-            if (auto next = (it + 1); next != tokens.end() && next->get_flag(WORD_LIKE)) {
-                token.value += next->value;
-                tokens.erase(next);
+namespace {
+    /**
+     * @brief Append @p tokens to @p out, replacing aliased COMMAND tokens with the tokens of the alias.
+     *
+     * @param out The vector to append to.
+     * @param tokens The tokens to expand.
+     * @param active Names of the aliases being expanded, which are not expanded again.
+     */
+    void expand_aliases_into(tokens_t &out, const tokens_t &tokens, std::unordered_set<std::string_view> &active) {
+        for (auto const &token: tokens) {
+            if (token.type == TokenType::COMMAND) {
+                auto alias = aliases.find(token.value());
+                if (alias != aliases.end() && !active.contains(alias->first)) {
+                    active.insert(alias->first);
+                    expand_aliases_into(out, alias->second.tokens, active);
+                    active.erase(alias->first);
+                    continue;
+                }
             }
-            auto pos = token.value.find('=');
-            auto var_name = token.value.substr(0, pos);
-            auto var_value = token.value.substr(pos + 1);
-            set_variable(var_name, var_value);
+            out.push_back(token);
         }
     }
-
-    // TODO! Handle illegal variable names. Only valid variable declarations should be processed
-    //  and removed from the vector, otherwise they should be treated as WORD tokens and left unchanged
-    // MAYBE: Handle temporary variable definitions - use it only for a simple command following the
-    //  definition, then dispose of it
 }
 
 /**
  * @brief Expand command aliases within a vector of tokens.
  *
  * Takes a vector of tokens and expands command aliases by replacing alias, defined with @c malias, with their
- * corresponding token sequences. Uses a stack-based approach to perform alias expansion, ensuring that
- * nested aliases are also expanded. Only COMMAND tokens are eligible for alias expansion.
+ * corresponding token sequences. Nested aliases are also expanded, except for the aliases whose expansion
+ * is in progress. Only COMMAND tokens are eligible for alias expansion.
+ *
+ * The aliases are lexed when defined, so their tokens are spliced in without lexing them again.
  *
  * @param tokens A vector of tokens to expand aliases within.
  * @note Alias expansion is performed in-place, i.e. the input vector is modified.
@@ -160,367 +64,403 @@ void set_variables(tokens_t &tokens) {
  * @see Token
  * @see token_flags
  * @see aliases
- * @see lexer()
  */
 void expand_aliases(tokens_t &tokens) {
-    std::vector<std::string> expanded;
-    expanded.reserve(aliases.size());
-    std::stack<std::pair<int, tokens_t>> stack;
-    stack.emplace(0, tokens);
-
-    size_t expansion_pointer = 0;
-    while (!stack.empty()) {
-        auto &curr_tokens = stack.top().second;
-
-        for (; expansion_pointer < curr_tokens.size(); expansion_pointer++) {
-            auto const &token = curr_tokens[expansion_pointer];
-
-            if (token.type != TokenType::COMMAND) {
-                continue;
-            }
-            if (std::ranges::find(expanded.begin(), expanded.end(), token.value) != expanded.end()) {
-                continue;
-            }
-
-            if (auto alias = aliases.find(token.value); alias != aliases.end()) {
-                expanded.push_back(token.value);
-                stack.emplace(expansion_pointer, lexer(alias->second));
-                expansion_pointer = 0;
-                break;
-            }
-        }
-
-        if (expansion_pointer >= curr_tokens.size()) {
-            auto [insert_to, top_tokens] = stack.top();
-
-            stack.pop();
-            if (stack.empty()) {
-                tokens = top_tokens;
-                continue;
-            }
-
-            auto &last_tokens = stack.top().second;
-
-            expanded.pop_back();
-            last_tokens.insert(last_tokens.begin() + insert_to + 1, top_tokens.begin(), top_tokens.end());
-            last_tokens.erase(last_tokens.begin() + insert_to);
-
-            expansion_pointer = insert_to + static_cast<int>(top_tokens.size());
-        }
+    auto is_alias = [](const Token &token) {
+        return token.type == TokenType::COMMAND && aliases.contains(token.value());
+    };
+    if (aliases.empty() || std::ranges::none_of(tokens, is_alias)) {
+        return;
     }
+
+    tokens_t expanded;
+    expanded.reserve(tokens.size());
+    std::unordered_set<std::string_view> active;
+    expand_aliases_into(expanded, tokens, active);
+    tokens = std::move(expanded);
 }
 
 
 /**
- * @brief Expand variables within a vector of tokens.
+ * @brief Check the syntax of a vector of tokens.
  *
- * Iterates through a vector of tokens and expands variables within tokens by
- * replacing them with their corresponding values. The expansion priority is given to internal variables.
- * If no variable with the given name is found, expansion result to an empty string.
+ * If syntax is incorrect, throws an exception.
  *
- * Tokens flagged as VAR_NO_EXPAND are not expanded. The word splitting is performed on the resulting
- * string, unless the token is flagged as NO_WORD_SPLIT.
+ * @param tokens A vector of tokens to check.
  *
- * @param tokens A vector of tokens to process and expand variables within.
- * @note Variable expansion is performed in-place, i.e. the input vector is modified.
+ * @throws msh_exception if syntax is incorrect.
  *
  * @see Token
  * @see token_flags
- * @see get_variable
  */
-void expand_vars(tokens_t &tokens) {
-    for (auto it = tokens.begin(); it != tokens.end(); ++it) {
-        auto &token = *it;
-        if (!token.get_flag(VAR_EXPAND)) {
+void check_syntax(const tokens_t &tokens) {
+    const Token *previous = nullptr;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        auto const &token = tokens[i];
+        // `()` of a function definition
+        bool is_definition = token.type == TokenType::SUBOPEN && previous != nullptr &&
+                             previous->type == TokenType::COMMAND && i + 1 < tokens.size() &&
+                             tokens[i + 1].type == TokenType::SUBCLOSE;
+        if (is_definition) {
+            previous = &tokens[++i];
             continue;
         }
-        std::string new_value;
-        for (size_t i = 0; i < token.value.size(); i++) {
-            if (token.value[i] == '\\' && i + 1 < token.value.size() && token.value[i + 1] == '$') {
-                new_value += token.value[++i];
-                continue;
-            }
-            if (token.value[i] != '$') {
-                new_value += token.value[i];
-                continue;
-            }
-            std::string var_name;
-            for (size_t j = i + 1; j < token.value.size(); j++) {
-                if (!isalnum(token.value[j]) && token.value[j] != '_') {
-                    break;
-                }
-                var_name += token.value[j];
-            }
-            if (var_name.empty()) {
-                new_value += token.value[i];
-                continue;
-            }
-            if (auto internal_var = get_variable(var_name); internal_var != nullptr) {
-                new_value += internal_var->value;
-                i += var_name.size();
-                continue;
-            }
-            auto var = getenv(var_name.data());
-            i += var_name.size();
-
-            if (var == nullptr) {
-                continue;
-            }
-            new_value += var;
+        if (token.get_flag(UNSUPPORTED)) {
+            throw msh_exception("unsupported token: " + std::string{token.value()});
         }
-
-        if (!token.get_flag(NO_WORD_SPLIT)) {
-            auto sub_tokens = split_words(new_value);
-            insert_tokens(tokens, it, sub_tokens);
-        } else {
-            token.value = std::move(new_value);
+        if (token.type != TokenType::EMPTY) {
+            previous = &token;
         }
     }
+
+    // Misplaced reserved words are reported by split_commands()
 }
 
 /**
- * @brief Perform command substitution within a vector of tokens.
- *
- * Iterates through a vector of tokens and replaces tokens of type COM_SUB with the output of the
- * underlying command by executing it in a subshell.
- *
- * Any trailing newlines are removed from the output. The word splitting is performed on the
- * resulting string, unless the token is flagged as NO_WORD_SPLIT.
- *
- * @param tokens A vector of tokens to process and substitute command substitutions within.
- * @note Command substitution is performed in-place, i.e. the input vector is modified.
+ * @brief Construct a shared pointer to a simple command from a vector of tokens.
  *
- * @throws msh_exception if an error occurs during command execution.
+ * @param tokens A vector of tokens to construct a simple command from.
+ * @return A shared pointer to a simple command.
  *
- * @see Token
- * @see token_flags
- * @see parse_input
+ * @see simple_command
  */
-void substitute_commands(tokens_t &tokens) {
-    for (auto it = tokens.begin(); it != tokens.end(); ++it) {
-        auto &token = *it;
-        if (token.type != TokenType::COM_SUB) {
-            continue;
+simple_command_ptr make_simple_command(const tokens_t &tokens) {
+    simple_command command(tokens);
+
+    return std::make_shared<simple_command>(std::move(command));
+}
+
+namespace {
+    /**
+     * @brief Reserved words ending a part of a compound command.
+     */
+    constexpr std::array<std::string_view, 7> closing_words = {"then", "elif", "else", "fi", "do", "done", "}"};
+
+    /**
+     * @brief Recursive descent parser building the tree of commands.
+     *
+     * Reserved words are recognized in command position only, i.e. as COMMAND tokens.
+     */
+    class command_parser {
+    public:
+        explicit command_parser(const tokens_t &tokens) : tokens(tokens) {}
+
+        command parse() {
+            auto res = parse_list({});
+            if (auto token = peek(); token != nullptr) {
+                throw msh_exception("unexpected token: " + std::string{token->value()}, INTERNAL_ERROR);
+            }
+            return res;
         }
 
-        int pipefd[2];
-        if (pipe(pipefd) == -1) {
-            throw msh_exception("command substitution: " + std::string{strerror(errno)});
+    private:
+        using terminators_t = std::initializer_list<std::string_view>;
+
+        const tokens_t &tokens;
+        size_t pos = 0;
+
+        const Token *peek() {
+            while (pos < tokens.size() && tokens[pos].type == TokenType::EMPTY) {
+                ++pos;
+            }
+            return pos < tokens.size() ? &tokens[pos] : nullptr;
         }
 
-        pid_t pid = fork();
-        if (pid == -1) {
-            throw msh_exception("command substitution: " + std::string{strerror(errno)});
-        } else if (pid > 0) {
-            int status;
-            close(pipefd[1]);
+        static bool is_keyword(const Token *token, std::string_view keyword) {
+            return token != nullptr && token->type == TokenType::COMMAND && token->value() == keyword;
+        }
 
-            waitpid(pid, &status, 0);
+        /**
+         * @brief Consume the reserved word @p keyword.
+         *
+         * @param any_position Whether to accept the word outside of command position too.
+         *
+         * @throws msh_incomplete_input if the input ends before the word.
+         * @throws msh_exception if another token is found instead.
+         */
+        void expect(std::string_view keyword, bool any_position = false) {
+            auto token = peek();
+            if (token == nullptr) {
+                throw msh_incomplete_input("expected '" + std::string{keyword} + "'");
+            }
+            if (token->value() != keyword || (token->type != TokenType::COMMAND &&
+                                              !(any_position && token->type == TokenType::WORD))) {
+                throw msh_exception("unexpected token: " + std::string{token->value()}, INTERNAL_ERROR);
+            }
+            ++pos;
+        }
 
-            std::string result;
-            char buf[1024];
-            ssize_t read_bytes;
+        bool accept(std::string_view keyword) {
+            if (is_keyword(peek(), keyword)) {
+                ++pos;
+                return true;
+            }
+            return false;
+        }
 
+        /**
+         * @brief Parse commands connected with `;`, `&`, `&&` and `||` up to one of @p terminators.
+         *
+         * The tree is built left to right, e.g. `a; b && c` is `(a; b) && c`. A trailing `;`,
+         * e.g. a newline before a terminator, is dropped.
+         */
+        command parse_list(terminators_t terminators) {
+            command res;
+            connection_command_ptr open;
             while (true) {
-                read_bytes = read(pipefd[0], buf, sizeof(buf));
-                if (read_bytes == -1) {
-                    if (errno == EINTR) {
-                        continue;
+                auto token = peek();
+                while (token != nullptr && token->type == TokenType::SEMICOLON && !open) {
+                    ++pos;
+                    token = peek();
+                }
+                if (token == nullptr) {
+                    break;
+                }
+                if (token->type == TokenType::COMMAND && std::ranges::find(closing_words, token->value()) != closing_words.end()) {
+                    if (std::ranges::find(terminators, token->value()) == terminators.end()) {
+                        throw msh_exception("unexpected token: " + std::string{token->value()}, INTERNAL_ERROR);
                     }
-                    throw msh_exception("command substitution: " + std::string{strerror(errno)});
+                    break;
                 }
-                if (read_bytes == 0) {
+
+                auto element = parse_pipeline();
+                (open ? open->rhs : res) = std::move(element);
+                open.reset();
+
+                token = peek();
+                if (token == nullptr || !token->get_flag(COMMAND_SEPARATOR)) {
                     break;
                 }
-                result.append(buf, read_bytes);
+                open = std::make_shared<connection_command>();
+                open->lhs = std::move(res);
+                open->connector = *token;
+                res = command(open);
+                ++pos;
             }
-            close(pipefd[0]);
 
-            boost::trim_right_if(result, boost::is_any_of("\n"));
+            if (open && open->connector.type == TokenType::SEMICOLON) {
+                return open->lhs;
+            }
+            return res;
+        }
 
-            if (!token.get_flag(NO_WORD_SPLIT)) {
-                auto sub_tokens = split_words(result);
-                insert_tokens(tokens, it, sub_tokens);
-            } else {
-                token.value = std::move(result);
+        command parse_pipeline() {
+            pipeline_command_ptr pipeline;
+            while (true) {
+                auto stage = parse_stage();
+                auto token = peek();
+                bool is_pipe = token != nullptr && (token->type == TokenType::PIPE || token->type == TokenType::PIPE_AMP);
+                if (!is_pipe && !pipeline) {
+                    return stage;
+                }
+                if (!pipeline) {
+                    pipeline = std::make_shared<pipeline_command>();
+                }
+                pipeline->add_stage(std::move(stage), is_pipe ? token : nullptr);
+                if (!is_pipe) {
+                    return command(pipeline);
+                }
+                ++pos;
             }
-        } else {
-            close(pipefd[0]);
-            dup2(pipefd[1], STDOUT_FILENO);
-            close(pipefd[1]);
+        }
 
-            auto command = parse_input(token.value);
-            exit(command.execute());
+        static bool is_compound(const Token *token) {
+            if (token == nullptr || token->type != TokenType::COMMAND) {
+                return false;
+            }
+            auto keyword = token->value();
+            return keyword == "if" || keyword == "while" || keyword == "until" || keyword == "for" || keyword == "{";
         }
-    }
-}
 
-/**
- * @brief Expand glob patterns within a vector of tokens.
- *
- * Iterates through a vector of tokens and expands glob patterns within tokens by
- * matching them against files in the file system. If no files are matched, the glob pattern
- * is left unchanged. Token with matched glob pattern is replaced with a sequence of
- * WORD tokens containing the matched file names.
- *
- * Tokens flagged as GLOB_NO_EXPAND are not expanded.
- *
- * @param tokens A vector of tokens to process and expand glob patterns within.
- * @note Glob expansion is performed in-place, i.e. the input vector is modified.
- *
- * @see Token
- * @see token_flags
- * @see glob
- */
-void expand_glob(tokens_t &tokens) {
-    tokens_t expanded_tokens;
-    for (auto it = tokens.begin(); it != tokens.end(); ++it) {
-        auto &token = *it;
-        if (!token.get_flag(GLOB_EXPAND)) {
-            continue;
+        /**
+         * @brief Check whether a function definition, i.e. `name()`, starts at the current token.
+         */
+        bool at_function_definition() {
+            if (tokens[pos].type != TokenType::COMMAND) {
+                return false;
+            }
+            auto next = pos + 1;
+            while (next < tokens.size() && tokens[next].type == TokenType::EMPTY) {
+                ++next;
+            }
+            return next + 1 < tokens.size() && tokens[next].type == TokenType::SUBOPEN &&
+                   tokens[next + 1].type == TokenType::SUBCLOSE;
         }
 
-        glob_t glob_result;
-        glob(token.value.data(), GLOB_TILDE, nullptr, &glob_result);
-        if (glob_result.gl_pathc == 0) {
-            globfree(&glob_result);
-            continue;
+        command parse_stage() {
+            auto token = peek();
+            if (is_compound(token)) {
+                return parse_compound();
+            }
+            if (token != nullptr && at_function_definition()) {
+                return parse_function();
+            }
+
+            tokens_t command_tokens;
+            for (; pos < tokens.size() && !tokens[pos].get_flag(COMMAND_SEPARATOR); ++pos) {
+                command_tokens.push_back(tokens[pos]);
+            }
+            return command(make_simple_command(command_tokens));
         }
-        expanded_tokens.reserve(glob_result.gl_pathc * 2 - 1);
-        for (size_t j = 0; j < glob_result.gl_pathc; j++) {
-            expanded_tokens.emplace_back(TokenType::WORD, glob_result.gl_pathv[j]);
-            if (j != glob_result.gl_pathc - 1) {
-                expanded_tokens.emplace_back(TokenType::EMPTY);
+
+        command parse_compound() {
+            using kind_t = compound_command::kind_t;
+
+            auto compound = std::make_shared<compound_command>();
+            auto keyword = tokens[pos++].value();
+            if (keyword == "if") {
+                compound->kind = kind_t::IF;
+                do {
+                    compound->conditions.push_back(parse_list({"then"}));
+                    expect("then");
+                    compound->bodies.push_back(parse_list({"elif", "else", "fi"}));
+                } while (accept("elif"));
+                if (accept("else")) {
+                    compound->bodies.push_back(parse_list({"fi"}));
+                }
+                expect("fi");
+            } else if (keyword == "while" || keyword == "until") {
+                compound->kind = keyword == "while" ? kind_t::WHILE : kind_t::UNTIL;
+                compound->conditions.push_back(parse_list({"do"}));
+                expect("do");
+                compound->bodies.push_back(parse_list({"done"}));
+                expect("done");
+            } else if (keyword == "{") {
+                compound->kind = kind_t::GROUP;
+                compound->bodies.push_back(parse_list({"}"}));
+                expect("}");
+            } else {
+                compound->kind = kind_t::FOR;
+                parse_for_words(*compound);
+                expect("do", true);
+                compound->bodies.push_back(parse_list({"done"}));
+                expect("done");
             }
+
+            compound->redirections = parse_redirections();
+            return command(compound);
         }
-        insert_tokens(tokens, it, expanded_tokens);
-        globfree(&glob_result);
-        expanded_tokens.clear();
-    }
-}
 
-/**
- * @brief Squash the adjacent tokens flagged as WORD_LIKE.
- * @param tokens A vector of tokens to process.
- */
-void squash_tokens(tokens_t &tokens) {
-    if (tokens.empty()) {
-        return;
-    }
-    std::transform(tokens.begin(), tokens.end() - 1, tokens.begin() + 1, tokens.begin(),
-                   [](Token &a, Token &b) {
-                       if (a.get_flag(WORD_LIKE) && b.get_flag(WORD_LIKE)) {
-                           b.value = a.value + b.value;
-                           a.set_type(TokenType::EMPTY);
-                       }
-                       return a;
-                   });
-}
+        /**
+         * @brief Parse a function definition, i.e. `name() body`. The body is a compound command.
+         */
+        command parse_function() {
+            auto function = std::make_shared<compound_command>();
+            function->kind = compound_command::FUNCTION;
+            function->variable = tokens[pos].value();
+            while (tokens[pos].type != TokenType::SUBCLOSE) {
+                ++pos;
+            }
+            ++pos;
 
-/**
- * @brief Check the syntax of a vector of tokens.
- *
- * If syntax is incorrect, throws an exception.
- *
- * @param tokens A vector of tokens to check.
- *
- * @throws msh_exception if syntax is incorrect.
- *
- * @see Token
- * @see token_flags
- */
-void check_syntax(const tokens_t &tokens) {
-    for (auto const &token: tokens) {
-        if (token.get_flag(UNSUPPORTED)) {
-            throw msh_exception("unsupported token: " + std::string{token.value});
+            auto token = peek();
+            while (token != nullptr && token->type == TokenType::SEMICOLON) {
+                ++pos;
+                token = peek();
+            }
+            if (token == nullptr) {
+                throw msh_incomplete_input("expected a function body");
+            }
+            if (!is_compound(token)) {
+                throw msh_exception("unexpected token: " + std::string{token->value()}, INTERNAL_ERROR);
+            }
+            function->bodies.push_back(parse_compound());
+            return command(function);
         }
-    }
 
-    // TODO! Currently only checks for unsupported tokens.
-    //  Add proper syntax checking for unexpected tokens, etc. Add support for multiline input
-}
+        /**
+         * @brief Parse the variable and the words of `for`, up to `do`.
+         *
+         * Without `in`, the words are the positional parameters, i.e. `"$@"`.
+         */
+        void parse_for_words(compound_command &compound) {
+            auto token = peek();
+            if (token == nullptr) {
+                throw msh_incomplete_input("expected a variable name");
+            }
+            auto name = token->value();
+            bool is_name = token->type == TokenType::WORD && !name.empty() && !isdigit(name[0]) &&
+                           std::ranges::all_of(name, [](char c) { return isalnum(c) || c == '_'; });
+            if (!is_name) {
+                throw msh_exception("for: invalid variable name: " + std::string{name}, INTERNAL_ERROR);
+            }
+            compound.variable = name;
+            ++pos;
 
-/**
- * @brief Construct a shared pointer to a simple command from a vector of tokens.
- *
- * @param tokens A vector of tokens to construct a simple command from.
- * @return A shared pointer to a simple command.
- *
- * @see simple_command
- */
-simple_command_ptr make_simple_command(const tokens_t &tokens) {
-    simple_command command(tokens);
+            token = peek();
+            if (token == nullptr || token->type != TokenType::WORD || token->value() != "in") {
+                compound.words = lexer("\"$@\"");
+            } else {
+                for (++pos; pos < tokens.size() && !tokens[pos].get_flag(COMMAND_SEPARATOR); ++pos) {
+                    compound.words.push_back(tokens[pos]);
+                }
+            }
 
-    return std::make_shared<simple_command>(std::move(command));
+            token = peek();
+            if (token != nullptr && token->type == TokenType::SEMICOLON) {
+                ++pos;
+            }
+        }
+
+        /**
+         * @brief Collect the redirections following a compound command.
+         *
+         * @throws msh_exception if anything else follows the command.
+         */
+        tokens_t parse_redirections() {
+            tokens_t res;
+            const Token *previous = nullptr;
+            bool in_target = false;
+            for (; pos < tokens.size() && !tokens[pos].get_flag(COMMAND_SEPARATOR); ++pos) {
+                auto const &token = tokens[pos];
+                bool is_fd = pos + 1 < tokens.size() && tokens[pos + 1].get_flag(REDIRECT);
+                // A target may consist of several tokens, e.g. a"b" or the body of a here-document
+                bool is_target = (previous != nullptr && previous->get_flag(REDIRECT)) ||
+                                 (in_target && tokens[pos - 1].type != TokenType::EMPTY);
+                if (token.get_flag(WORD_LIKE) && !is_fd && !is_target) {
+                    throw msh_exception("unexpected token: " + std::string{token.value()}, INTERNAL_ERROR);
+                }
+                in_target = is_target && token.get_flag(WORD_LIKE);
+                if (token.type != TokenType::EMPTY) {
+                    previous = &token;
+                }
+                res.push_back(token);
+            }
+            return res;
+        }
+    };
 }
 
 /**
  * @brief Split a vector of tokens into a tree structure of commands.
  *
- * Each node of the tree is a command object, which can be either a simple command or
- * a connection command. The connection command contains a connector token and two
- * command objects, lhs and rhs. Returns the root of the tree.
+ * Each node of the tree is a command object, which can be either a simple command,
+ * a pipeline command, a connection command or a compound command. The connection command
+ * contains a connector token and two command objects, lhs and rhs. Returns the root of the tree.
+ *
+ * Commands connected with `|` or `|&` are collected into a single pipeline command, so
+ * pipelines bind tighter than other connectors, e.g. `a && b | c` is `a && (b | c)`.
+ *
+ * `if`, `while`, `until`, `for`, `{ }` and function definitions are parsed into compound
+ * commands holding the trees of their parts, so a loop or a function is parsed once no matter
+ * how many times its body is executed.
  *
  * @note Alias expansion is performed on whole command sequence before splitting.
  *
  * @param tokens A vector of tokens to split.
  * @return The root of the tree of commands.
  *
+ * @throws msh_incomplete_input if a compound command is not closed.
+ * @throws msh_exception if a reserved word is misplaced.
+ *
  * @see command
  * @see simple_command
+ * @see pipeline_command
  * @see connection_command
+ * @see compound_command
  */
 command split_commands(tokens_t &tokens) {
     expand_aliases(tokens);
 
-	tokens_t current_command_tokens;
-    struct command res_command;
-    connection_command_ptr connection;
-    auto simple = &res_command.cmd;
-
-	for (const auto & token : tokens) {
-	      if (token.get_flag(COMMAND_SEPARATOR)) {
-              *simple = make_simple_command(current_command_tokens);
-
-	          command new_cmd(std::make_shared<connection_command>());
-              connection = std::get<connection_command_ptr>(new_cmd.cmd);
-	          connection->lhs = res_command;
-	          connection->connector = token;
-
-              simple = &connection->rhs.cmd;
-
-              res_command = new_cmd;
-	          current_command_tokens.clear();
-	          continue;
-	      }
-          current_command_tokens.push_back(token);
-	}
-
-    *simple = make_simple_command(current_command_tokens);
-	return res_command;
-}
-
-/**
- * @brief Process a vector of tokens.
- *
- * Performs all necessary token processing steps in the correct order.
- *
- * @param tokens A vector of tokens to process.
- *
- * @throws msh_exception if an error occurs during token processing.
- * Must be handled elsewhere.
- *
- * @see expand_vars
- * @see substitute_commands
- * @see set_variables
- * @see expand_glob
- * @see squash_tokens
- */
-void process_tokens(tokens_t &tokens) {
-    postprocess_tokens(tokens);
-    expand_vars(tokens);
-    substitute_commands(tokens);
-    set_variables(tokens);
-    expand_glob(tokens);
-    squash_tokens(tokens);
+    return command_parser(tokens).parse();
 }
@@ -2,43 +2,90 @@
 // PVS-Studio Static Code Analyzer for C, C++, C#, and Java: http://www.viva64.com
 
 #include "internal/msh_builtin.h"
+#include "internal/msh_exec.h"
 #include "internal/msh_utils.h"
 #include "internal/msh_parser.h"
 #include "internal/msh_internal.h"
+#include "internal/msh_output.h"
 
 #include <cstdio>
+#include <string_view>
+#include <unistd.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
+/**
+ * @brief Parse the input, reading more lines while it is incomplete, e.g. inside a loop.
+ *
+ * @param input The first line of the input, the whole input on return.
+ * @return The parsed command.
+ *
+ * @throws msh_exception if the input is invalid or ends before the command is complete.
+ */
+static command parse_interactive(std::string &input) {
+    while (true) {
+        try {
+            return parse_input(input);
+        } catch (const msh_incomplete_input &) {
+            msh_out.flush();
+            char *line = readline("> ");
+            if (line == nullptr) {
+                throw;
+            }
+            input += '\n';
+            input += line;
+            free(line);
+        }
+    }
+}
+
 // MAYBE: Add signal handling. Also see src/internal/jobs.cpp.
 //  Possible behavior: https://www.gnu.org/software/bash/manual/html_node/Signals.html
 int main(int argc, char *argv[]) {
-    msh_init();
+    // Scripts, `-c` and piped commands skip readline, the history and the prompt entirely
+    bool interactive = argc == 1 && isatty(STDIN_FILENO);
+    msh_init(interactive);
 
+    if (argc > 1 && std::string_view{argv[1]} == "-c") {
+        if (argc < 3) {
+            msh_error("-c: option requires an argument");
+            return INTERNAL_ERROR;
+        }
+        return msh_exec_string(argv[2]);
+    }
     if (argc > 1) {
         msource(argc, argv);
         return 0;
     }
+    if (!interactive) {
+        return msh_exec_stdin();
+    }
 
     rl_reset_terminal(nullptr); // To prevent `readline` from messing up the terminal.
 
-    char *input_buffer;
-    while ((input_buffer = readline(generate_prompt().data())) != nullptr) {
-        if (input_buffer[0] != '\0') {
-            add_history(input_buffer);
+    while (true) {
+        msh_out.flush();
+        char *input_buffer = readline(generate_prompt().data());
+        if (input_buffer == nullptr) {
+            break;
         }
+        std::string input = input_buffer;
+        free(input_buffer);
 
         update_jobs();
         try {
-            auto command = parse_input(input_buffer);
+            auto command = parse_interactive(input);
+            if (!input.empty()) {
+                add_history(input.c_str());
+            }
             command.execute();
         } catch (const msh_exception &e) {
+            if (!input.empty()) {
+                add_history(input.c_str());
+            }
             msh_error(e.what());
             msh_errno = e.code();
         }
-
-        free(input_buffer);
-        std::cout << std::endl;
     }
 
     return 0;